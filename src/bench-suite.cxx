@@ -0,0 +1,358 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <xdg-desktop-file.hxx>
+#include <xdg-mapped-desktop-file.hxx>
+#include <xdg-icon-theme.hxx>
+#include <xdg-application-index.hxx>
+#include <xdg-async.hxx>
+#include <iostream>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+#include "xdg-utils.hxx"
+#include "xdg-batch-read.hxx"
+#include "bench-tree.hxx"
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+using namespace std;
+using namespace bench_tree;
+
+namespace {
+
+using clock_type = chrono::steady_clock;
+
+double elapsed_ms(clock_type::time_point const & start)
+{
+	return chrono::duration<double, milli>(clock_type::now()-start).count();
+}
+
+// Generated tree and how the suite runs on it.
+struct config : public bench_tree::shape {
+	int iterations;
+	string lang;
+	string directory;  //< parent of the generated tree instead of $TMPDIR.
+	bool keep;         //< do not remove the tree at exit.
+
+	config() : iterations{10}, lang{"fr_FR.UTF-8"}, keep{false} { }
+};
+
+// Plain open and read, as the parser did before batch_reader.
+string read_file(string const & path)
+{
+	string ret;
+	int fd = open(path.c_str(), O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return ret;
+	struct stat st;
+	if (fstat(fd, &st) == 0 and st.st_size > 0) {
+		ret.resize(st.st_size);
+		auto n = read(fd, &ret[0], ret.size());
+		ret.resize(n > 0 ? n : 0);
+	}
+	close(fd);
+	return ret;
+}
+
+string json_string(string const & s)
+{
+	string ret{"\""};
+	for (auto c: s) {
+		if (c == '"' or c == '\\')
+			ret.push_back('\\');
+		ret.push_back(c);
+	}
+	ret.push_back('"');
+	return ret;
+}
+
+/**
+ * Run f for each iteration and print one JSON object per line, ops is the
+ * number of operations done by one call of f.
+ **/
+void run(config const & cfg, string const & root, string const & name, string const & state,
+		size_t ops, function<size_t()> const & f)
+{
+	vector<double> samples;
+	size_t check = 0;
+	// Fill the result cache first.
+	if (state == "cached")
+		f();
+	for (int i = 0; i < cfg.iterations; ++i) {
+		if (state == "cold")
+			evict(root);
+		auto start = clock_type::now();
+		check += f();
+		samples.push_back(elapsed_ms(start));
+	}
+
+	sort(samples.begin(), samples.end());
+	double total = 0.0;
+	for (auto x: samples)
+		total += x;
+	double mean = total/samples.size();
+	cout << "{\"benchmark\": " << json_string(name)
+			<< ", \"state\": " << json_string(state)
+			<< ", \"iterations\": " << samples.size()
+			<< ", \"ops\": " << ops
+			<< ", \"min_ms\": " << samples.front()
+			<< ", \"median_ms\": " << samples[samples.size()/2]
+			<< ", \"mean_ms\": " << mean
+			<< ", \"ns_per_op\": " << mean*1e6/max<size_t>(ops, 1)
+			<< ", \"check\": " << check << "}" << endl;
+}
+
+void run_suite(config const & cfg, string const & root)
+{
+	cout << "{\"suite\": \"libxdg\", \"themes\": " << cfg.themes
+			<< ", \"subdirs\": " << cfg.subdirs
+			<< ", \"icons\": " << cfg.icons
+			<< ", \"applications\": " << cfg.applications
+			<< ", \"translations\": " << cfg.translations
+			<< ", \"lang\": " << json_string(cfg.lang) << "}" << endl;
+
+	auto files = xdg::desktop_file::list_all_application_files();
+	for (auto state: {"cold", "warm"}) {
+		run(cfg, root, "desktop_file", state, files.size(), [&]() {
+			size_t ret = 0;
+			for (auto & f: files)
+				ret += xdg::desktop_file(f, cfg.lang).size();
+			return ret;
+		});
+		run(cfg, root, "mapped_desktop_file", state, files.size(), [&]() {
+			size_t ret = 0;
+			for (auto & f: files)
+				ret += xdg::mapped_desktop_file(f, cfg.lang).size();
+			return ret;
+		});
+		// Only reading, one file at a time then by batches.
+		run(cfg, root, "read_serial", state, files.size(), [&]() {
+			size_t ret = 0;
+			for (auto & f: files)
+				ret += read_file(f).size();
+			return ret;
+		});
+		for (auto io_uring: {false, true}) {
+			xdg::batch_reader reader{io_uring};
+			if (io_uring and not reader.uses_io_uring())
+				continue;
+			run(cfg, root, io_uring?"read_io_uring":"read_readahead", state, files.size(), [&]() {
+				size_t ret = 0;
+				reader.for_each(files, [&](string const &, string && contents) {
+					ret += contents.size();
+				});
+				return ret;
+			});
+		}
+		run(cfg, root, "list_all_applications", state, 1, [&]() {
+			return xdg::desktop_file::list_all_applications(cfg.lang).size();
+		});
+		run(cfg, root, "list_all_applications_mapped", state, 1, [&]() {
+			return xdg::mapped_desktop_file::list_all_applications(cfg.lang).size();
+		});
+		run(cfg, root, "list_all_applications_threads", state, 1, [&]() {
+			return xdg::mapped_desktop_file::list_all_applications(cfg.lang, 0).size();
+		});
+		run(cfg, root, "theme_eager", state, 1, [&]() {
+			xdg::theme theme{theme_name(cfg, 0), 0, xdg::theme::eager};
+			return theme.find_icon(icon_name(0, 0), 48, 1).size();
+		});
+		run(cfg, root, "theme_lazy", state, 1, [&]() {
+			xdg::theme theme{theme_name(cfg, 0), 0, xdg::theme::lazy};
+			return theme.find_icon(icon_name(0, 0), 48, 1).size();
+		});
+	}
+
+	// Launcher searches, one query per keystroke.
+	auto applications = xdg::desktop_file::list_all_applications(cfg.lang);
+	run(cfg, root, "application_index_build", "warm", applications.size(), [&]() {
+		return xdg::application_index{applications}.size();
+	});
+
+	vector<string> queries;
+	for (auto word: {"bench application 42", "generated", "new window"})
+		for (size_t n = 1; n <= strlen(word); ++n)
+			queries.emplace_back(word, n);
+	xdg::application_index const index{applications};
+	run(cfg, root, "application_search", "warm", queries.size(), [&]() {
+		size_t ret = 0;
+		for (auto & q: queries)
+			ret += index.search(q, 10).size();
+		return ret;
+	});
+	// Same fields walked for each query, as a launcher without the index.
+	run(cfg, root, "application_search_linear", "warm", queries.size(), [&]() {
+		size_t ret = 0;
+		for (auto & q: queries) {
+			auto query = xdg::application_index::normalize(q);
+			for (auto & a: applications) {
+				auto g = a.find("Desktop Entry");
+				if (g == a.end())
+					continue;
+				for (auto key: {"Name", "GenericName", "Keywords", "Exec"}) {
+					auto value = xdg::application_index::normalize(g->second.getattr<string>(key, ""));
+					if (value.find(query) != string::npos) {
+						ret += 1;
+						break;
+					}
+				}
+			}
+		}
+		return ret;
+	});
+
+	// Hits in every theme of the chain, then misses that walk all of them.
+	vector<string> hits;
+	vector<string> misses;
+	for (int t = 0; t <= cfg.themes; ++t)
+		for (int i = 0; i < cfg.icons; ++i)
+			hits.push_back(icon_name(t, i));
+	for (int i = 0; i < cfg.icons; ++i)
+		misses.push_back("bench-missing-"+to_string(i));
+
+	xdg::theme uncached{theme_name(cfg, 0), 0};
+	xdg::theme cached{theme_name(cfg, 0)};
+	for (auto & theme: {&uncached, &cached}) {
+		string state = theme == &uncached?"warm":"cached";
+		for (auto names: {&hits, &misses}) {
+			run(cfg, root, names == &hits?"find_icon_hit":"find_icon_miss", state, names->size()*4, [&]() {
+				size_t ret = 0;
+				for (auto & n: *names)
+					for (auto size: {16, 24, 48, 96})
+						ret += theme->find_icon(n, size, 1).size();
+				return ret;
+			});
+		}
+	}
+
+	// Same lookups as find_icon_hit warm, spread over the shared pool.
+	auto shared_uncached = make_shared<xdg::theme const>(theme_name(cfg, 0), 0);
+	run(cfg, root, "find_icon_async", "warm", hits.size()*4, [&]() {
+		vector<future<string>> results;
+		results.reserve(hits.size()*4);
+		for (auto & n: hits)
+			for (auto size: {16, 24, 48, 96})
+				results.push_back(xdg::find_icon_async(shared_uncached, n, size, 1));
+		size_t ret = 0;
+		for (auto & r: results)
+			ret += r.get().size();
+		return ret;
+	});
+
+	// Size tables are built once per icon, then any size is a binary search.
+	vector<xdg::icon_size_table> tables;
+	run(cfg, root, "icon_sizes_build", "warm", hits.size(), [&]() {
+		tables.clear();
+		for (auto & n: hits)
+			tables.push_back(uncached.icon_sizes(n));
+		return tables.size();
+	});
+	run(cfg, root, "icon_sizes_lookup", "warm", hits.size()*8, [&]() {
+		size_t ret = 0;
+		for (auto & table: tables)
+			for (auto scale: {1, 2})
+				for (auto size: {16, 24, 48, 96})
+					ret += table.lookup(size, scale).size();
+		return ret;
+	});
+}
+
+void usage(char const * name)
+{
+	cerr << "usage: " << name << " [-n iterations] [--themes N] [--subdirs N] [--icons N]" << endl;
+	cerr << "       [--applications N] [--translations N] [--lang LANG] [--dir DIR] [--keep]" << endl;
+	cerr << endl;
+	cerr << "Generate a synthetic XDG tree in a new directory within DIR, or $TMPDIR, and" << endl;
+	cerr << "print one JSON object per benchmark. Only the new directory is removed." << endl;
+}
+
+} // anonymous namespace
+
+int main(int argc, char ** argv)
+{
+	config cfg;
+	for (int i = 1; i < argc; ++i) {
+		string opt = argv[i];
+		bool has_value = i+1 < argc;
+		if (opt == "-n" and has_value) {
+			cfg.iterations = atoi(argv[++i]);
+		} else if (opt == "--themes" and has_value) {
+			cfg.themes = atoi(argv[++i]);
+		} else if (opt == "--subdirs" and has_value) {
+			cfg.subdirs = atoi(argv[++i]);
+		} else if (opt == "--icons" and has_value) {
+			cfg.icons = atoi(argv[++i]);
+		} else if (opt == "--applications" and has_value) {
+			cfg.applications = atoi(argv[++i]);
+		} else if (opt == "--translations" and has_value) {
+			cfg.translations = atoi(argv[++i]);
+		} else if (opt == "--lang" and has_value) {
+			cfg.lang = argv[++i];
+		} else if (opt == "--dir" and has_value) {
+			cfg.directory = argv[++i];
+		} else if (opt == "--keep") {
+			cfg.keep = true;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (cfg.iterations < 1 or cfg.themes < 0 or cfg.subdirs < 1 or cfg.icons < 0
+			or cfg.applications < 0 or cfg.translations < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	// Always a new directory, thus removing it never touches files of the user.
+	string parent = cfg.directory;
+	if (parent.empty()) {
+		char const * TMPDIR = getenv("TMPDIR");
+		parent = TMPDIR?TMPDIR:"/tmp";
+	}
+	string root = create_root(parent);
+	if (root.empty()) {
+		cerr << "ERROR: cannot create a directory within " << parent << endl;
+		return 1;
+	}
+
+	generate(cfg, root);
+
+	use_tree(root, cfg.lang);
+
+	run_suite(cfg, root);
+
+	if (cfg.keep)
+		cerr << "generated tree kept in " << root << endl;
+	else
+		remove_tree(root);
+	return 0;
+}
@@ -0,0 +1,210 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "bench-tree.hxx"
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ftw.h>
+}
+
+namespace bench_tree {
+
+using namespace std;
+
+char const * const contexts[] = {"apps", "actions", "places", "status", "devices", "mimetypes"};
+int const sizes[] = {16, 22, 24, 32, 48, 64, 96, 128, 256, 512};
+
+// Real locales first, then made up ones.
+char const * const locales[] = {"fr", "fr_FR", "de", "de_DE", "es", "it", "ja",
+		"zh_CN", "zh_TW", "pt", "pt_BR", "ru", "pl", "nl", "sv", "fr_CA@euro"};
+
+static string locale_name(int i)
+{
+	size_t n = sizeof locales/sizeof *locales;
+	if (static_cast<size_t>(i) < n)
+		return locales[i];
+	return "x"+to_string(i);
+}
+
+void make_directory(string const & path)
+{
+	// Create parents first.
+	for (auto p = path.find('/', 1); p != string::npos; p = path.find('/', p+1))
+		mkdir(path.substr(0, p).c_str(), 0755);
+	mkdir(path.c_str(), 0755);
+}
+
+void write_file(string const & path, string const & content)
+{
+	ofstream out(path, ios::out | ios::binary | ios::trunc);
+	out << content;
+}
+
+string theme_name(shape const & cfg, int t)
+{
+	return t < cfg.themes?"bench-"+to_string(t):"hicolor";
+}
+
+// Subdir s of every theme, sizes first then contexts, the last is scalable.
+static string subdir_name(int s, int & size, bool & scalable)
+{
+	size_t n_sizes = sizeof sizes/sizeof *sizes;
+	size_t n_contexts = sizeof contexts/sizeof *contexts;
+	size = sizes[s%n_sizes];
+	scalable = (s/n_sizes)%4 == 3;
+	string ret = scalable?"scalable":(to_string(size)+"x"+to_string(size));
+	ret += "/";
+	ret += contexts[(s/n_sizes)%n_contexts];
+	if (s >= static_cast<int>(n_sizes*n_contexts))
+		ret += "-"+to_string(s/(n_sizes*n_contexts));
+	return ret;
+}
+
+string icon_name(int t, int i)
+{
+	return "bench-icon-"+to_string(t)+"-"+to_string(i);
+}
+
+static void generate_theme(shape const & cfg, string const & icons_dir, int t)
+{
+	string dir = icons_dir+"/"+theme_name(cfg, t);
+	ostringstream index;
+	ostringstream groups;
+	index << "[Icon Theme]\nName=" << theme_name(cfg, t) << "\nComment=Generated\n";
+	if (t < cfg.themes)
+		index << "Inherits=" << theme_name(cfg, t+1) << "\n";
+	index << "Directories=";
+	for (int s = 0; s < cfg.subdirs; ++s) {
+		int size;
+		bool scalable;
+		string subdir = subdir_name(s, size, scalable);
+		index << (s?",":"") << subdir;
+		groups << "\n[" << subdir << "]\nSize=" << size << "\n";
+		if (scalable)
+			groups << "MinSize=8\nMaxSize=512\nType=Scalable\n";
+		else
+			groups << "Type=Fixed\n";
+		make_directory(dir+"/"+subdir);
+		// Every icon name is available in every subdir.
+		for (int i = 0; i < cfg.icons; ++i)
+			write_file(dir+"/"+subdir+"/"+icon_name(t, i)+(scalable?".svg":".png"), "");
+	}
+	index << "\n" << groups.str();
+	write_file(dir+"/index.theme", index.str());
+}
+
+static void generate_application(shape const & cfg, string const & path, int a)
+{
+	ostringstream out;
+	out << "[Desktop Entry]\nType=Application\nName=Bench application " << a << "\n";
+	int n = cfg.translations?a%(cfg.translations+1):0;
+	for (int l = 0; l < n; ++l)
+		out << "Name[" << locale_name(l) << "]=Bench application " << a << " " << locale_name(l) << "\n";
+	out << "Comment=Generated application " << a << "\n";
+	for (int l = 0; l < n; ++l)
+		out << "Comment[" << locale_name(l) << "]=Generated application " << a << " " << locale_name(l) << "\n";
+	out << "Exec=bench-application-" << a << " %U\n";
+	out << "Icon=" << icon_name(a%(cfg.themes+1), a%max(cfg.icons, 1)) << "\n";
+	out << "Categories=Utility;Development;\nKeywords=bench;generated;\n";
+	if (a%10 == 0)
+		out << "NoDisplay=true\n";
+	out << "\n[Desktop Action new-window]\nName=New Window\nExec=bench-application-" << a << " --new-window\n";
+	write_file(path, out.str());
+}
+
+void generate(shape const & cfg, string const & root)
+{
+	string icons_dir = root+"/share/icons";
+	for (int t = 0; t <= cfg.themes; ++t)
+		generate_theme(cfg, icons_dir, t);
+
+	// One tenth of the files in a vendor subdir.
+	string apps_dir = root+"/share/applications";
+	make_directory(apps_dir+"/vendor");
+	for (int a = 0; a < cfg.applications; ++a) {
+		string dir = a%10 == 9?apps_dir+"/vendor":apps_dir;
+		generate_application(cfg, dir+"/bench-application-"+to_string(a)+".desktop", a);
+	}
+}
+
+static int evict_file(char const * path, struct stat const * st, int flag, struct FTW *)
+{
+	if (flag != FTW_F)
+		return 0;
+	int fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd >= 0) {
+		posix_fadvise(fd, 0, st->st_size, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+	return 0;
+}
+
+void evict(string const & root)
+{
+	sync();
+	nftw(root.c_str(), evict_file, 16, FTW_PHYS);
+}
+
+static int remove_entry(char const * path, struct stat const *, int, struct FTW *)
+{
+	remove(path);
+	return 0;
+}
+
+void remove_tree(string const & root)
+{
+	nftw(root.c_str(), remove_entry, 16, FTW_DEPTH|FTW_PHYS);
+}
+
+string create_root(string const & parent)
+{
+	make_directory(parent);
+	string tmpl = parent+"/libxdg-bench-XXXXXX";
+	vector<char> buffer{tmpl.begin(), tmpl.end()};
+	buffer.push_back('\0');
+	if (mkdtemp(buffer.data()) == nullptr)
+		return string{};
+	return buffer.data();
+}
+
+void use_tree(string const & root, string const & lang)
+{
+	setenv("XDG_DATA_DIRS", (root+"/share").c_str(), 1);
+	setenv("XDG_DATA_HOME", (root+"/share").c_str(), 1);
+	setenv("XDG_CACHE_HOME", (root+"/cache").c_str(), 1);
+	setenv("HOME", root.c_str(), 1);
+	setenv("LANG", lang.c_str(), 1);
+	unsetenv("LC_ALL");
+	unsetenv("LC_MESSAGES");
+}
+
+} // namespace bench_tree
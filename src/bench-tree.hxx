@@ -0,0 +1,74 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef SRC_BENCH_TREE_HXX_
+#define SRC_BENCH_TREE_HXX_
+
+#include <string>
+
+/**
+ * Synthetic XDG tree shared by bench-xdg-suite and the checks, thus they
+ * do not depend on the themes and applications of the host.
+ **/
+namespace bench_tree {
+
+/**
+ * Shape of the generated XDG tree. Icon themes form a single inheritance
+ * chain bench-0 -> bench-1 -> ... -> hicolor, application files get from 0
+ * to translations translated Name and Comment, cycling over the files.
+ **/
+struct shape {
+	int themes;        //< inherit depth, hicolor excluded.
+	int subdirs;       //< subdirs per theme.
+	int icons;         //< icons per subdir.
+	int applications;  //< desktop files.
+	int translations;  //< maximum translations per desktop file.
+
+	shape() : themes{3}, subdirs{40}, icons{50}, applications{1000}, translations{40} { }
+};
+
+std::string theme_name(shape const & s, int t);
+std::string icon_name(int t, int i);
+
+void make_directory(std::string const & path);
+void write_file(std::string const & path, std::string const & content);
+
+// Write the tree as root/share, root must exist.
+void generate(shape const & s, std::string const & root);
+
+// New directory within parent, empty if it cannot be created.
+std::string create_root(std::string const & parent);
+
+// Make libxdg only see the tree generated in root, for lang.
+void use_tree(std::string const & root, std::string const & lang);
+
+/**
+ * Drop the page cache of the tree, directory entries and inodes stay
+ * cached thus cold results are a lower bound of a real cold start.
+ **/
+void evict(std::string const & root);
+
+void remove_tree(std::string const & root);
+
+} // namespace bench_tree
+
+#endif /* SRC_BENCH_TREE_HXX_ */
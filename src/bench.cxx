@@ -0,0 +1,1230 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <xdg-desktop-file.hxx>
+#include <xdg-mapped-desktop-file.hxx>
+#include <xdg-application-cache.hxx>
+#include <xdg-icon-theme.hxx>
+#include <xdg-stats.hxx>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <regex>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <limits>
+#include <cstdlib>
+#include <new>
+
+#include "xdg-utils.hxx"
+#include "bench-tree.hxx"
+#include "xdg-icon-subdir-table.hxx"
+#include "xdg-desktop-file-parser.hxx"
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <malloc.h>
+}
+
+using namespace std;
+
+#ifndef LIBXDG_ALLOCATION_ACCOUNTING
+
+/**
+ * Count heap allocations of the whole process, libxdg included, for the
+ * memory benchmark. libxdg built with allocation accounting replaces
+ * operator new itself, its process wide counters are used instead.
+ **/
+static atomic<size_t> g_allocations{0};
+static atomic<size_t> g_live_bytes{0};
+static atomic<size_t> g_peak_bytes{0};
+
+// Out of line, thus the compiler does not pair malloc with operator delete.
+__attribute__((noinline)) static void * allocate(size_t size)
+{
+	return malloc(size?size:1);
+}
+
+__attribute__((noinline)) static void deallocate(void * p)
+{
+	free(p);
+}
+
+void * operator new(size_t size)
+{
+	void * p = allocate(size);
+	if (p == nullptr)
+		throw bad_alloc{};
+	g_allocations += 1;
+	size_t live = g_live_bytes += malloc_usable_size(p);
+	size_t peak = g_peak_bytes;
+	while (live > peak and not g_peak_bytes.compare_exchange_weak(peak, live)) { }
+	return p;
+}
+
+void * operator new(size_t size, nothrow_t const &) noexcept
+{
+	try {
+		return operator new(size);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+void operator delete(void * p) noexcept
+{
+	if (p == nullptr)
+		return;
+	g_live_bytes -= malloc_usable_size(p);
+	deallocate(p);
+}
+
+void operator delete(void * p, nothrow_t const &) noexcept
+{
+	operator delete(p);
+}
+
+// Sized form, called by code built as C++14 or later.
+void operator delete(void * p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+#endif
+
+namespace {
+
+using clock_type = chrono::steady_clock;
+
+double elapsed_ms(clock_type::time_point const & start)
+{
+	return chrono::duration<double, milli>(clock_type::now()-start).count();
+}
+
+/**
+ * The regex based parser used before libxdg got its own scanner, kept here
+ * as reference for the benchmark.
+ **/
+unordered_map<string, xdg::group> legacy_parse(string const & filename, string const & lang)
+{
+	unordered_map<string, xdg::group> ret;
+	ifstream fin(filename);
+
+	static regex const comment("^(#[^\\n]*\\n?)|(\\s+)$");
+	static regex const group("^\\[([^[:cntrl:]]+)\\]\\n?$");
+	static regex const entry("^([a-zA-Z0-9-]+)(\\[([a-zA-Z]+)(_[a-zA-Z-]+)?(\\.[a-zA-Z-]+)?(@[a-zA-Z]+)?\\])?\\s?=\\s?([^\\n]*)\\n?$");
+	static regex const locale("^([a-zA-Z]+)(_[a-zA-Z]+)?(\\.[a-zA-Z]+)?(@[a-zA-Z]+)?$");
+
+	string language, territory, modifier;
+	{
+		smatch m;
+		if (regex_match(lang, m, locale)) {
+			language  = m[1];
+			territory = m[2];
+			modifier  = m[4];
+		}
+	}
+
+	xdg::group * cur_group = nullptr;
+	vector<char> buffer;
+	while(not fin.eof()) {
+		buffer.push_back(fin.get());
+		if (buffer.back() != '\n')
+			continue;
+		string s{buffer.begin(), buffer.end()};
+		buffer.clear();
+		smatch m;
+		if (regex_match(s, comment)) {
+			continue;
+		} else if (regex_match(s, m, group)) {
+			cur_group = &ret[m[1]];
+		} else if (regex_match(s, m, entry)) {
+			if (cur_group == nullptr)
+				continue;
+			string key = m[1];
+			xdg::entry_data tmp;
+			tmp.data = m[7];
+			tmp.score = 0;
+			if (m[2] != "") {
+				if (language != "")
+					tmp.score += (language == m[3])?8:-16;
+				if (territory != "")
+					tmp.score += (territory == m[4])?4:-16;
+				if (modifier != "")
+					tmp.score += (modifier == m[6])?2:-16;
+			}
+			if (tmp.score >= 0) {
+				auto f = cur_group->find(key);
+				if (f == cur_group->end()) {
+					(*cur_group)[key] = tmp;
+				} else if (f->second.score < tmp.score) {
+					f->second = tmp;
+				}
+			}
+		}
+	}
+	return ret;
+}
+
+/**
+ * The subdir rule of the icon theme before it was flattened into
+ * xdg::subdir_table, kept here as reference for the benchmark.
+ **/
+struct legacy_subdir_rule {
+	int scale;
+	int size;
+
+	union {
+		struct {
+			int min_size;
+			int max_size;
+		};
+		int threshold;
+	};
+
+	struct s_vtable {
+		bool (legacy_subdir_rule::*match) (int, int) const;
+		int  (legacy_subdir_rule::*distance) (int, int) const;
+	};
+
+	enum : char {
+		TYPE_UNKNOWN   = 0,
+		TYPE_THREHOLD  = 1,
+		TYPE_FIXED     = 2,
+		TYPE_SCALABLE  = 3,
+		TYPE_MAX       = 4
+	} type;
+
+	static s_vtable const _api[TYPE_MAX];
+
+	bool match_unknown(int, int) const
+	{
+		return false;
+	}
+
+	bool match_fixed(int size, int scale) const
+	{
+		if (scale != this->scale)
+			return false;
+		return this->size == size;
+	}
+
+	bool match_scaled(int size, int scale) const
+	{
+		if (scale != this->scale)
+			return false;
+		return min_size <= size and size <= max_size;
+	}
+
+	bool match_threshold(int size, int scale) const
+	{
+		if (scale != this->scale)
+			return false;
+		return std::abs(size-this->size) <= threshold;
+	}
+
+	int dist_unknown(int, int) const
+	{
+		return std::numeric_limits<int>::max();
+	}
+
+	int dist_fixed(int size, int scale) const
+	{
+		return std::abs(this->size*this->scale-size*scale);
+	}
+
+	int dist_scaled(int size, int scale) const
+	{
+		if (size*scale < this->min_size*this->scale)
+			return this->min_size*this->scale - size*scale;
+		if (size*scale > this->max_size*this->scale)
+			return size*scale - this->max_size*this->scale;
+		return 0;
+	}
+
+	int dist_threshold(int size, int scale) const
+	{
+		if (size*scale < (this->size-this->threshold)*this->scale)
+			return (this->size-this->threshold)*this->scale - size*scale;
+		if (size*scale > (this->size+this->threshold)*this->scale)
+			return size*scale - (this->size+this->threshold)*this->scale;
+		return 0;
+	}
+
+	legacy_subdir_rule(xdg::mapped_group const & subdir)
+	{
+		size  = subdir.getattr<int>("Size");
+		scale = subdir.getattr<int>("Scale", 1);
+
+		string stype = subdir.getattr<string>("Type", "Threshold");
+
+		if (stype == "Threshold") {
+			threshold = subdir.getattr<int>("Threshold", 2);
+			type = TYPE_THREHOLD;
+		} else if (stype == "Scalable") {
+			min_size = subdir.getattr<int>("MinSize", size);
+			max_size = subdir.getattr<int>("MaxSize", size);
+			type = TYPE_SCALABLE;
+		} else if (stype == "Fixed") {
+			type = TYPE_FIXED;
+		} else {
+			type = TYPE_UNKNOWN;
+		}
+	}
+
+	bool match(int size, int scale) const
+	{
+		return (this->*_api[type].match)(size, scale);
+	}
+
+	int dist(int size, int scale) const
+	{
+		return (this->*_api[type].distance)(size, scale);
+	}
+
+};
+
+legacy_subdir_rule::s_vtable const legacy_subdir_rule::_api[TYPE_MAX]  = {
+		{&legacy_subdir_rule::match_unknown, &legacy_subdir_rule::dist_unknown},
+		{&legacy_subdir_rule::match_threshold, &legacy_subdir_rule::dist_threshold},
+		{&legacy_subdir_rule::match_fixed, &legacy_subdir_rule::dist_fixed},
+		{&legacy_subdir_rule::match_scaled, &legacy_subdir_rule::dist_scaled}
+};
+
+vector<string> find_desktop_files()
+{
+	vector<string> ret;
+	vector<string> pending;
+	char const * XDG_DATA_DIRS = std::getenv("XDG_DATA_DIRS");
+	for (auto & p: xdg::split(XDG_DATA_DIRS?XDG_DATA_DIRS:"/usr/local/share:/usr/share", ':'))
+		pending.push_back(p+"/applications");
+	while (not pending.empty()) {
+		string dirname = pending.back();
+		pending.pop_back();
+		DIR * dir = opendir(dirname.c_str());
+		if (dir == nullptr)
+			continue;
+		struct dirent * p;
+		while((p = readdir(dir)) != nullptr) {
+			if (p->d_name[0] == '.')
+				continue;
+			if (p->d_type == DT_DIR)
+				pending.push_back(dirname+"/"+p->d_name);
+			auto len = strlen(p->d_name);
+			if (len > 8 and strcmp(p->d_name+len-8, ".desktop") == 0)
+				ret.push_back(dirname+"/"+p->d_name);
+		}
+		closedir(dir);
+	}
+	return ret;
+}
+
+/**
+ * Locale scoring as done before xdg::locale_matcher: both the locale and
+ * the key locale are split for each localized entry.
+ **/
+struct legacy_locale_parts {
+	xdg::string_view language;
+	xdg::string_view territory;
+	xdg::string_view codeset;
+	xdg::string_view modifier;
+
+	legacy_locale_parts(xdg::string_view const & s)
+	{
+		auto cur = s.begin();
+		auto end = s.end();
+
+		auto next = cur;
+		while (next != end and *next != '_' and *next != '.' and *next != '@')
+			++next;
+		language = xdg::string_view{cur, next};
+		cur = next;
+
+		if (cur != end and *cur == '_') {
+			next = ++cur;
+			while (next != end and *next != '.' and *next != '@')
+				++next;
+			territory = xdg::string_view{cur, next};
+			cur = next;
+		}
+
+		if (cur != end and *cur == '.') {
+			next = ++cur;
+			while (next != end and *next != '@')
+				++next;
+			codeset = xdg::string_view{cur, next};
+			cur = next;
+		}
+
+		if (cur != end and *cur == '@') {
+			modifier = xdg::string_view{cur+1, end};
+		}
+	}
+
+	int32_t score(legacy_locale_parts const & entry) const
+	{
+		int32_t score = 0;
+		if (not language.empty())
+			score += language == entry.language?8:-16;
+		if (not territory.empty())
+			score += territory == entry.territory?4:-16;
+		if (not modifier.empty())
+			score += modifier == entry.modifier?2:-16;
+		return score;
+	}
+};
+
+// Collect the locales of all localized entries.
+struct locale_collector {
+	vector<xdg::string_view> & locales;
+
+	void group(xdg::string_view const &) { }
+	void invalid(xdg::string_view const &) { }
+	void entry(xdg::string_view const &, xdg::string_view const & locale, bool localized, xdg::string_view const &)
+	{
+		if (localized)
+			locales.push_back(locale);
+	}
+};
+
+string read_file(string const & filename)
+{
+	ifstream fin(filename, ios::in | ios::binary);
+	return string{istreambuf_iterator<char>{fin}, istreambuf_iterator<char>{}};
+}
+
+/**
+ * Score every localized entry of files in memory, with the per entry split
+ * of the previous parser and with xdg::locale_matcher. Both do not keep
+ * exactly the same entries, the previous scoring discarded keys without
+ * territory when the locale has one.
+ **/
+int bench_locale(vector<string> files, int iterations)
+{
+	if (files.empty())
+		files = find_desktop_files();
+
+	vector<string> contents;
+	vector<xdg::string_view> locales;
+	for (auto & f: files)
+		contents.push_back(read_file(f));
+	for (auto & c: contents) {
+		locale_collector collector{locales};
+		xdg::parse_desktop_file(c.data(), c.data()+c.size(), collector);
+	}
+	if (locales.empty()) {
+		cerr << "no localized entries" << endl;
+		return 1;
+	}
+
+	string lang = xdg::getenv_lang();
+
+	size_t legacy_kept = 0;
+	auto start = clock_type::now();
+	for (int i = 0; i < iterations; ++i) {
+		legacy_locale_parts const locale{lang};
+		for (auto & l: locales)
+			legacy_kept += locale.score(legacy_locale_parts{l}) >= 0;
+	}
+	double legacy = elapsed_ms(start);
+
+	size_t kept = 0;
+	start = clock_type::now();
+	for (int i = 0; i < iterations; ++i) {
+		xdg::locale_matcher const locale{lang};
+		for (auto & l: locales)
+			kept += locale.score(l) >= 0;
+	}
+	double matcher = elapsed_ms(start);
+
+	double count = static_cast<double>(locales.size())*iterations;
+	cout << "locale: " << locales.size() << " localized entries in " << files.size()
+			<< " files x " << iterations << " iterations, LANG=" << lang << endl;
+	cout << "  split:   " << legacy*1e6/count << " ns/entry" << endl;
+	cout << "  matcher: " << matcher*1e6/count << " ns/entry" << endl;
+	cout << "  speedup: " << legacy/matcher << "x" << endl;
+	// The matcher follow the spec, e.g. Name[fr] is kept for fr_FR.
+	cout << "  kept:    " << legacy_kept/iterations << " (split), " << kept/iterations << " (matcher)" << endl;
+	return 0;
+}
+
+int bench_parse(vector<string> files, int iterations)
+{
+	if (files.empty())
+		files = find_desktop_files();
+	if (files.empty()) {
+		cerr << "no desktop files to parse" << endl;
+		return 1;
+	}
+
+	string lang = xdg::getenv_lang();
+	size_t check = 0;
+
+	auto start = clock_type::now();
+	for (int i = 0; i < iterations; ++i)
+		for (auto & f: files)
+			check += legacy_parse(f, lang).size();
+	double legacy = elapsed_ms(start);
+
+	start = clock_type::now();
+	for (int i = 0; i < iterations; ++i)
+		for (auto & f: files)
+			check += xdg::desktop_file(f, lang).size();
+	double scanner = elapsed_ms(start);
+
+	start = clock_type::now();
+	for (int i = 0; i < iterations; ++i)
+		for (auto & f: files)
+			check += xdg::mapped_desktop_file(f, lang).size();
+	double mapped = elapsed_ms(start);
+
+	size_t count = files.size()*iterations;
+	cout << "parse: " << files.size() << " files x " << iterations << " iterations" << endl;
+	cout << "  regex:   " << legacy << " ms (" << legacy*1000.0/count << " us/file)" << endl;
+	cout << "  scanner: " << scanner << " ms (" << scanner*1000.0/count << " us/file)" << endl;
+	cout << "  mapped:  " << mapped << " ms (" << mapped*1000.0/count << " us/file)" << endl;
+	cout << "  speedup: " << legacy/scanner << "x (scanner), " << legacy/mapped << "x (mapped)" << endl;
+	return check == 0;
+}
+
+int bench_scan(vector<string> const & args, int iterations)
+{
+	unsigned nthreads = args.empty()?0:atoi(args[0].c_str());
+	string lang = xdg::getenv_lang();
+	size_t check = 0;
+
+	auto start = clock_type::now();
+	for (int i = 0; i < iterations; ++i)
+		check += xdg::desktop_file::list_all_applications(lang, 1).size();
+	double sequential = elapsed_ms(start);
+
+	start = clock_type::now();
+	for (int i = 0; i < iterations; ++i)
+		check += xdg::desktop_file::list_all_applications(lang, nthreads).size();
+	double parallel = elapsed_ms(start);
+
+	cout << "scan: " << check/(2*iterations) << " files x " << iterations << " iterations" << endl;
+	cout << "  sequential: " << sequential/iterations << " ms/scan" << endl;
+	cout << "  parallel:   " << parallel/iterations << " ms/scan (threads=" << nthreads << ")" << endl;
+	cout << "  speedup:    " << sequential/parallel << "x" << endl;
+	return check == 0;
+}
+
+int bench_cache(int iterations)
+{
+	// The cache file of the user is left alone, it is written in a
+	// temporary XDG_CACHE_HOME.
+	char const * TMPDIR = std::getenv("TMPDIR");
+	string root = bench_tree::create_root(TMPDIR?TMPDIR:"/tmp");
+	if (root.empty()) {
+		cerr << "cannot create a temporary directory" << endl;
+		return 1;
+	}
+	char const * XDG_CACHE_HOME = std::getenv("XDG_CACHE_HOME");
+	string saved_cache_home = XDG_CACHE_HOME?XDG_CACHE_HOME:"";
+	setenv("XDG_CACHE_HOME", root.c_str(), 1);
+
+	string lang = xdg::getenv_lang();
+	string filename = xdg::application_cache::filename(lang);
+	xdg::application_cache::stats st;
+	size_t check = 0;
+
+	// No cache file, everything is parsed and the cache is written. The
+	// desktop files stay in the page cache, this is not a cold start.
+	double uncached = 0.0;
+	for (int i = 0; i < iterations; ++i) {
+		unlink(filename.c_str());
+		auto start = clock_type::now();
+		check += xdg::application_cache::list_all_applications(lang, &st).size();
+		uncached += elapsed_ms(start);
+	}
+
+	auto start = clock_type::now();
+	for (int i = 0; i < iterations; ++i)
+		check += xdg::application_cache::list_all_applications(lang, &st).size();
+	double cached = elapsed_ms(start);
+
+	bench_tree::remove_tree(root);
+	if (XDG_CACHE_HOME)
+		setenv("XDG_CACHE_HOME", saved_cache_home.c_str(), 1);
+	else
+		unsetenv("XDG_CACHE_HOME");
+
+	cout << "cache: " << st.files << " files in " << st.directories << " directories x " << iterations << " iterations" << endl;
+	cout << "  uncached: " << uncached/iterations << " ms/load (parse and cache write)" << endl;
+	cout << "  cached: " << cached/iterations << " ms/load (" << st.reparsed_directories << " directories parsed)" << endl;
+	cout << "  speedup: " << uncached/cached << "x" << endl;
+	return check == 0;
+}
+
+// Icon names used by installed applications, plus some missing ones.
+vector<string> application_icon_names()
+{
+	vector<string> ret;
+	for (auto & f: xdg::mapped_desktop_file::list_all_applications(xdg::getenv_lang())) {
+		auto g = f.find("Desktop Entry");
+		if (g == f.end())
+			continue;
+		auto icon = g->second.getattr<string>("Icon", "");
+		if (not icon.empty() and icon[0] != '/')
+			ret.push_back(icon);
+	}
+	for (int i = 0; i < 16; ++i)
+		ret.push_back("libxdg-bench-missing-"+to_string(i));
+	return ret;
+}
+
+int bench_icons_mt(vector<string> const & args, int iterations)
+{
+	string theme_name = args.empty()?"hicolor":args[0];
+	vector<string> names{args.size() > 1?args.begin()+1:args.end(), args.end()};
+	if (names.empty())
+		names = application_icon_names();
+
+	xdg::theme theme{theme_name};
+	static int const sizes[] = {16, 24, 32, 48, 64};
+
+	unsigned max_threads = max(4u, thread::hardware_concurrency());
+	cout << "icons-mt: theme " << theme_name << ", " << names.size() << " names x 5 sizes x " << iterations << " iterations per thread" << endl;
+	for (unsigned nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+		atomic<size_t> check{0};
+		auto start = clock_type::now();
+		vector<thread> threads;
+		for (unsigned t = 0; t < nthreads; ++t) {
+			threads.emplace_back([&, t]() {
+				size_t c = 0;
+				for (int i = 0; i < iterations; ++i)
+					for (size_t n = 0; n < names.size(); ++n)
+						for (auto size: sizes)
+							c += theme.find_icon(names[(n+t)%names.size()], size, 1).size();
+				check += c;
+			});
+		}
+		for (auto & t: threads)
+			t.join();
+		double ms = elapsed_ms(start);
+		double lookups = static_cast<double>(nthreads)*iterations*names.size()*5;
+		cout << "  threads=" << nthreads << ": " << lookups*1000.0/ms << " lookups/s" << endl;
+	}
+
+	auto st = theme.get_cache_stats();
+	cout << "  cache: " << st.hits << " hits, " << st.misses << " misses, "
+			<< st.evictions << " evictions, " << st.size << "/" << st.capacity << " entries" << endl;
+	return 0;
+}
+
+int bench_icons_batch(vector<string> const & args, int iterations)
+{
+	string theme_name = args.empty()?"hicolor":args[0];
+	vector<string> names{args.size() > 1?args.begin()+1:args.end(), args.end()};
+	if (names.empty())
+		names = application_icon_names();
+
+	// No result cache, to compare the lookups themselves.
+	xdg::theme theme{theme_name, 0};
+
+	vector<xdg::icon_request> requests;
+	for (auto & n: names)
+		for (auto scale: {1, 2})
+			for (auto size: {16, 24, 32, 48, 64})
+				requests.push_back(xdg::icon_request{n, size, scale});
+
+	vector<string> single(requests.size());
+	auto start = clock_type::now();
+	for (int i = 0; i < iterations; ++i)
+		for (size_t r = 0; r < requests.size(); ++r)
+			single[r] = theme.find_icon(requests[r].name, requests[r].size, requests[r].scale);
+	double loop = elapsed_ms(start);
+
+	vector<string> batch;
+	start = clock_type::now();
+	for (int i = 0; i < iterations; ++i)
+		batch = theme.find_icons(requests);
+	double batched = elapsed_ms(start);
+
+	cout << "icons-batch: theme " << theme_name << ", " << requests.size() << " requests x " << iterations << " iterations" << endl;
+	cout << "  loop:    " << loop/iterations << " ms/batch" << endl;
+	cout << "  batch:   " << batched/iterations << " ms/batch" << endl;
+	cout << "  speedup: " << loop/batched << "x" << endl;
+
+	if (single != batch) {
+		cerr << "ERROR: find_icons and find_icon results differ" << endl;
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Latency of the theme construction alone and up to the first lookup, in
+ * eager and lazy mode.
+ **/
+int bench_startup(vector<string> const & args, int iterations)
+{
+	string theme_name = args.empty()?"hicolor":args[0];
+	vector<string> names{args.size() > 1?args.begin()+1:args.end(), args.end()};
+	if (names.empty())
+		names = application_icon_names();
+
+	cout << "startup: theme " << theme_name << ", " << iterations << " iterations" << endl;
+	for (auto mode: {xdg::theme::eager, xdg::theme::lazy}) {
+		double construct = 0.0;
+		double first_lookup = 0.0;
+		for (int i = 0; i < iterations; ++i) {
+			auto start = clock_type::now();
+			xdg::theme theme{theme_name, 0, mode};
+			construct += elapsed_ms(start);
+			theme.find_icon(names[i%names.size()], 48, 1);
+			first_lookup += elapsed_ms(start);
+		}
+		cout << "  " << (mode == xdg::theme::lazy?"lazy: ":"eager:") << " construct " << construct/iterations
+				<< " ms, construct+first lookup " << first_lookup/iterations << " ms" << endl;
+	}
+	return 0;
+}
+
+string find_theme_index_file(string const & theme_name)
+{
+	char const * XDG_DATA_DIRS = std::getenv("XDG_DATA_DIRS");
+	for (auto & p: xdg::split(XDG_DATA_DIRS?XDG_DATA_DIRS:"/usr/local/share:/usr/share", ':')) {
+		string f = p+"/icons/"+theme_name+"/index.theme";
+		if (access(f.c_str(), R_OK) == 0)
+			return f;
+	}
+	return string{};
+}
+
+/**
+ * Select the subdir for each size as the lookup does when an icon is in
+ * every subdir of the theme: first exact match, else the closest one.
+ **/
+int bench_subdirs(vector<string> const & args, int iterations)
+{
+	string theme_name = args.empty()?"hicolor":args[0];
+	string filename = find_theme_index_file(theme_name);
+	if (filename.empty()) {
+		cerr << "no index.theme for " << theme_name << endl;
+		return 1;
+	}
+
+	xdg::mapped_desktop_file const data{filename, xdg::getenv_lang()};
+	auto icon_theme = data.find("Icon Theme");
+	if (icon_theme == data.end()) {
+		cerr << "invalid index.theme " << filename << endl;
+		return 1;
+	}
+
+	unordered_map<string, legacy_subdir_rule> legacy;
+	vector<xdg::subdir_rule> rules;
+	for (auto & s: xdg::split(icon_theme->second.getattr<string>("Directories", ""), ',')) {
+		auto subdir = data.find(s);
+		if (subdir == data.end() or legacy.count(s))
+			continue;
+		legacy.emplace(s, legacy_subdir_rule{subdir->second});
+		rules.emplace_back(s, subdir->second);
+	}
+	xdg::subdir_table const table{rules};
+	if (table.size() == 0) {
+		cerr << "no subdirs in " << filename << endl;
+		return 1;
+	}
+
+	vector<pair<int, int>> sizes;
+	for (auto scale: {1, 2})
+		for (auto size: {16, 20, 22, 24, 32, 40, 48, 64, 96, 128, 256, 512})
+			sizes.emplace_back(size, scale);
+
+	// Result of each selection: -1 on exact match, else the distance.
+	vector<int> legacy_results;
+	auto start = clock_type::now();
+	for (int i = 0; i < iterations; ++i) {
+		legacy_results.clear();
+		for (auto & sz: sizes) {
+			legacy_subdir_rule const * found = nullptr;
+			for (auto & x: legacy) {
+				if (x.second.match(sz.first, sz.second)) { found = &x.second; break; }
+			}
+			int best = -1;
+			if (not found) {
+				best = numeric_limits<int>::max();
+				for (auto & x: legacy)
+					best = min(best, x.second.dist(sz.first, sz.second));
+			}
+			legacy_results.push_back(best);
+		}
+	}
+	double map_ms = elapsed_ms(start);
+
+	vector<int> table_results;
+	start = clock_type::now();
+	for (int i = 0; i < iterations; ++i) {
+		table_results.clear();
+		for (auto & sz: sizes) {
+			bool found = false;
+			for (size_t s = 0; s < table.size() and not found; ++s)
+				found = table.match(s, sz.first, sz.second);
+			int best = -1;
+			if (not found) {
+				best = numeric_limits<int>::max();
+				for (size_t s = 0; s < table.size(); ++s)
+					best = min(best, table.dist(s, sz.first, sz.second));
+			}
+			table_results.push_back(best);
+		}
+	}
+	double table_ms = elapsed_ms(start);
+
+	// Whole table at once, as done by find_icons.
+	vector<char> match(table.size());
+	vector<int> dist(table.size());
+	size_t check = 0;
+	start = clock_type::now();
+	for (int i = 0; i < iterations; ++i) {
+		for (auto & sz: sizes) {
+			table.evaluate(sz.first, sz.second, match.data(), dist.data());
+			check += match[0] + dist[0];
+		}
+	}
+	double evaluate_ms = elapsed_ms(start);
+
+	double count = static_cast<double>(iterations)*sizes.size();
+	cout << "subdirs: theme " << theme_name << ", " << table.size() << " subdirs, "
+			<< sizes.size() << " sizes x " << iterations << " iterations" << endl;
+	cout << "  map:      " << map_ms*1e6/count << " ns/selection" << endl;
+	cout << "  table:    " << table_ms*1e6/count << " ns/selection" << endl;
+	cout << "  evaluate: " << evaluate_ms*1e6/count << " ns/size" << endl;
+	cout << "  speedup:  " << map_ms/table_ms << "x" << endl;
+
+	if (legacy_results != table_results) {
+		cerr << "ERROR: map and table selections differ" << endl;
+		return 1;
+	}
+	return check == 0;
+}
+
+// getattr as it was before group::convert, with an istringstream per value.
+template<typename T>
+T istringstream_getattr(xdg::mapped_group const & g, char const * key, T const & default_value)
+{
+	auto x = g.find(key);
+	if (x == g.end())
+		return default_value;
+	T ret;
+	istringstream(xdg::mapped_group::unescape(x->data)) >> ret;
+	return ret;
+}
+
+// Same fields as subdir_rule, parsed with istringstream_getattr.
+struct istringstream_subdir_rule {
+	uint8_t type;
+	int size;
+	int scale;
+	int min_size;
+	int max_size;
+
+	istringstream_subdir_rule(xdg::mapped_group const & subdir);
+};
+
+istringstream_subdir_rule::istringstream_subdir_rule(xdg::mapped_group const & subdir)
+{
+	auto & ret = *this;
+	ret.size = istringstream_getattr<int>(subdir, "Size", 0);
+	ret.scale = istringstream_getattr<int>(subdir, "Scale", 1);
+	string stype = istringstream_getattr<string>(subdir, "Type", "Threshold");
+	if (stype == "Threshold") {
+		int threshold = istringstream_getattr<int>(subdir, "Threshold", 2);
+		ret.min_size = ret.size-threshold;
+		ret.max_size = ret.size+threshold;
+		ret.type = xdg::subdir_rule::TYPE_THRESHOLD;
+	} else if (stype == "Scalable") {
+		ret.min_size = istringstream_getattr<int>(subdir, "MinSize", ret.size);
+		ret.max_size = istringstream_getattr<int>(subdir, "MaxSize", ret.size);
+		ret.type = xdg::subdir_rule::TYPE_SCALABLE;
+	} else if (stype == "Fixed") {
+		ret.min_size = ret.size;
+		ret.max_size = ret.size;
+		ret.type = xdg::subdir_rule::TYPE_FIXED;
+	} else {
+		ret.min_size = 0;
+		ret.max_size = 0;
+		ret.type = xdg::subdir_rule::TYPE_UNKNOWN;
+	}
+}
+
+/**
+ * Build the subdir rules of a theme with group::convert and with the
+ * former istringstream, then the whole eager theme index.
+ **/
+int bench_convert(vector<string> const & args, int iterations)
+{
+	string theme_name = args.empty()?"hicolor":args[0];
+	string filename = find_theme_index_file(theme_name);
+	if (filename.empty()) {
+		cerr << "no index.theme for " << theme_name << endl;
+		return 1;
+	}
+
+	xdg::mapped_desktop_file const data{filename, xdg::getenv_lang()};
+	auto icon_theme = data.find("Icon Theme");
+	if (icon_theme == data.end()) {
+		cerr << "invalid index.theme " << filename << endl;
+		return 1;
+	}
+
+	vector<pair<string, xdg::mapped_group const *>> subdirs;
+	for (auto & s: xdg::split(icon_theme->second.getattr<string>("Directories", ""), ',')) {
+		auto subdir = data.find(s);
+		if (subdir != data.end())
+			subdirs.emplace_back(s, &subdir->second);
+	}
+
+	vector<xdg::subdir_rule> convert_rules;
+	vector<istringstream_subdir_rule> istringstream_rules;
+	auto start = clock_type::now();
+	for (int i = 0; i < iterations; ++i) {
+		convert_rules.clear();
+		for (auto & s: subdirs)
+			convert_rules.emplace_back(s.first, *s.second);
+	}
+	double convert_ms = elapsed_ms(start);
+
+	start = clock_type::now();
+	for (int i = 0; i < iterations; ++i) {
+		istringstream_rules.clear();
+		for (auto & s: subdirs)
+			istringstream_rules.emplace_back(*s.second);
+	}
+	double istringstream_ms = elapsed_ms(start);
+
+	start = clock_type::now();
+	for (int i = 0; i < iterations; ++i)
+		xdg::theme theme{theme_name, 0};
+	double theme_ms = elapsed_ms(start);
+
+	double count = static_cast<double>(iterations)*subdirs.size();
+	cout << "convert: theme " << theme_name << ", " << subdirs.size() << " subdirs x "
+			<< iterations << " iterations" << endl;
+	cout << "  istringstream: " << istringstream_ms*1e6/count << " ns/subdir" << endl;
+	cout << "  convert:       " << convert_ms*1e6/count << " ns/subdir" << endl;
+	cout << "  speedup:       " << istringstream_ms/convert_ms << "x" << endl;
+	cout << "  eager theme:   " << theme_ms/iterations << " ms" << endl;
+
+	for (size_t i = 0; i < convert_rules.size(); ++i) {
+		auto & a = convert_rules[i];
+		auto & b = istringstream_rules[i];
+		if (a.type != b.type or a.size != b.size or a.scale != b.scale
+				or a.min_size != b.min_size or a.max_size != b.max_size) {
+			cerr << "ERROR: convert and istringstream differ on " << subdirs[i].first << endl;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+#ifdef LIBXDG_ALLOCATION_ACCOUNTING
+
+struct allocation_counter {
+	size_t live_bytes;
+
+	allocation_counter()
+	{
+		xdg::reset_allocation_stats();
+		live_bytes = xdg::get_allocation_stats().live_bytes;
+	}
+
+	// Counters restart at each creation, they cannot be nested.
+	size_t count() const { return xdg::get_allocation_stats().allocations; }
+	long bytes() const { return static_cast<long>(xdg::get_allocation_stats().live_bytes)-static_cast<long>(live_bytes); }
+	size_t peak() const { return xdg::get_allocation_stats().peak_bytes-live_bytes; }
+};
+
+#else
+
+struct allocation_counter {
+	size_t allocations;
+	size_t live_bytes;
+
+	allocation_counter() : allocations{g_allocations}, live_bytes{g_live_bytes} { g_peak_bytes = live_bytes; }
+
+	size_t count() const { return g_allocations-allocations; }
+	long bytes() const { return static_cast<long>(g_live_bytes)-static_cast<long>(live_bytes); }
+	// Highest heap usage since creation, if counters are not nested.
+	size_t peak() const { return g_peak_bytes-live_bytes; }
+};
+
+#endif
+
+/**
+ * Heap used by a theme and by application lists, and allocations done by
+ * lookups. Mapped files are not counted.
+ **/
+int bench_memory(vector<string> const & args)
+{
+	string theme_name = args.empty()?"hicolor":args[0];
+	vector<string> names{args.size() > 1?args.begin()+1:args.end(), args.end()};
+	if (names.empty())
+		names = application_icon_names();
+	string lang = xdg::getenv_lang();
+
+	cout << "memory:" << endl;
+	{
+		allocation_counter c;
+		xdg::theme theme{theme_name, 0};
+		cout << "  theme " << theme_name << ": " << c.bytes() << " bytes, " << c.count() << " allocations" << endl;
+
+		size_t lookups = 0;
+		allocation_counter l;
+		for (auto & n: names)
+			for (auto size: {16, 24, 32, 48, 64}) {
+				theme.find_icon(n, size, 1);
+				lookups += 1;
+			}
+		cout << "  find_icon: " << static_cast<double>(l.count())/lookups << " allocations/lookup" << endl;
+	}
+
+	{
+		allocation_counter c;
+		auto list = xdg::desktop_file::list_all_applications(lang, 1);
+		long bytes = c.bytes();
+		cout << "  desktop_file: " << list.size() << " files, " << bytes << " bytes, "
+				<< c.peak() << " bytes peak, " << c.count() << " allocations" << endl;
+	}
+
+	{
+		allocation_counter c;
+		size_t files = 0;
+		size_t check = 0;
+		xdg::desktop_file::for_each_application(lang, {"Name", "Icon", "Exec", "NoDisplay"},
+				[&](xdg::desktop_file const & f) {
+			files += 1;
+			check += f.size();
+		});
+		cout << "  for_each_application: " << files << " files, " << c.peak() << " bytes peak, "
+				<< c.count() << " allocations" << endl;
+	}
+
+	{
+		allocation_counter c;
+		auto list = xdg::mapped_desktop_file::list_all_applications(lang, 1);
+		long bytes = c.bytes();
+		cout << "  mapped_desktop_file: " << list.size() << " files, " << bytes << " bytes, "
+				<< c.count() << " allocations" << endl;
+	}
+
+	{
+		// First call may write the cache.
+		xdg::application_cache::list_all_applications(lang);
+		allocation_counter c;
+		auto list = xdg::application_cache::list_all_applications(lang);
+		long bytes = c.bytes();
+		struct stat st;
+		auto cache_size = stat(xdg::application_cache::filename(lang).c_str(), &st) == 0?st.st_size:0;
+		cout << "  application_cache: " << list.size() << " files, " << bytes << " bytes, "
+				<< c.count() << " allocations, " << cache_size << " bytes mapped" << endl;
+	}
+
+	return 0;
+}
+
+void print_allocations(char const * name, xdg::allocation_stats const & st)
+{
+	cout << "  " << name << ": " << st.live_bytes << " bytes live, " << st.peak_bytes << " bytes peak, "
+			<< st.allocations << " allocations, " << st.deallocations << " deallocations" << endl;
+}
+
+/**
+ * Allocations charged to a theme and to an application scan, then the
+ * average allocations of find_icon once the theme is loaded, served by
+ * the result cache or not. Exit with 1 if an average is above max, for
+ * use as a regression check.
+ **/
+int bench_allocations(vector<string> args)
+{
+	double max = -1.0;
+	if (args.size() > 1 and args[0] == "--max") {
+		max = atof(args[1].c_str());
+		args.erase(args.begin(), args.begin()+2);
+	}
+	string theme_name = args.empty()?"hicolor":args[0];
+	vector<string> names{args.size() > 1?args.begin()+1:args.end(), args.end()};
+	if (names.empty())
+		names = application_icon_names();
+
+	cout << "allocations:" << (xdg::allocation_accounting_enabled()?"":" libxdg built without accounting") << endl;
+
+	xdg::reset_application_stats();
+	{
+		auto list = xdg::mapped_desktop_file::list_all_applications(xdg::getenv_lang());
+		print_allocations("application scan", xdg::get_application_stats().allocations);
+	}
+	print_allocations("application scan, freed", xdg::get_application_stats().allocations);
+
+	int ret = 0;
+	for (auto cache_capacity: {size_t{0}, xdg::theme::default_cache_capacity}) {
+		xdg::theme theme{theme_name, cache_capacity};
+		// Fill the cache and lazy parts of the theme first.
+		for (auto & n: names)
+			for (auto size: {16, 24, 32, 48, 64})
+				theme.find_icon(n, size, 1);
+		print_allocations(cache_capacity?"theme, cached":"theme", theme.get_stats().allocations);
+
+		size_t lookups = 0;
+		allocation_counter c;
+		for (auto & n: names)
+			for (auto size: {16, 24, 32, 48, 64}) {
+				theme.find_icon(n, size, 1);
+				lookups += 1;
+			}
+		double average = lookups?static_cast<double>(c.count())/lookups:0.0;
+		cout << "  find_icon" << (cache_capacity?", cached":"") << ": " << average << " allocations/lookup" << endl;
+		if (max >= 0.0 and average > max) {
+			cerr << "find_icon" << (cache_capacity?", cached":"") << ": " << average
+					<< " allocations/lookup, above " << max << endl;
+			ret = 1;
+		}
+	}
+	return ret;
+}
+
+void print_counter(char const * name, uint64_t value)
+{
+	cout << "  " << name << ": " << value << endl;
+}
+
+void print_latency(char const * name, xdg::latency_histogram const & h)
+{
+	cout << "  " << name << ": " << h.count << " samples, mean " << h.mean_ns()/1000.0
+			<< " us, p50 < " << h.quantile_ns(0.5)/1000.0 << " us, p99 < "
+			<< h.quantile_ns(0.99)/1000.0 << " us" << endl;
+}
+
+void print_stats(xdg::stats const & st)
+{
+	print_counter("files_parsed", st.files_parsed);
+	print_counter("bytes_read", st.bytes_read);
+	print_counter("invalid_entries", st.invalid_entries);
+	print_counter("directories_read", st.directories_read);
+	print_counter("access_calls", st.access_calls);
+	print_counter("stat_calls", st.stat_calls);
+	print_counter("themes_loaded", st.themes_loaded);
+	print_counter("icons_found", st.icons_found);
+	print_counter("icons_missing", st.icons_missing);
+	print_counter("cache_hits", st.cache_hits);
+	print_counter("cache_misses", st.cache_misses);
+	print_latency("parse", st.parse);
+	print_latency("theme_load", st.theme_load);
+	print_latency("index_build", st.index_build);
+	print_latency("lookup", st.lookup);
+	print_latency("scan", st.scan);
+}
+
+// Stats collected by a theme and by an application scan.
+int bench_stats(vector<string> const & args, int iterations)
+{
+	string theme_name = args.empty()?"hicolor":args[0];
+	vector<string> names{args.size() > 1?args.begin()+1:args.end(), args.end()};
+	if (names.empty())
+		names = application_icon_names();
+
+	xdg::reset_application_stats();
+	for (int i = 0; i < iterations; ++i)
+		xdg::mapped_desktop_file::list_all_applications(xdg::getenv_lang());
+	cout << "stats: applications, " << iterations << " scans" << endl;
+	print_stats(xdg::get_application_stats());
+
+	xdg::theme theme{theme_name};
+	for (int i = 0; i < iterations; ++i)
+		for (auto & n: names)
+			for (auto size: {16, 24, 32, 48, 64})
+				theme.find_icon(n, size, 1);
+	cout << "stats: theme " << theme_name << ", " << names.size() << " names x 5 sizes x " << iterations << " iterations" << endl;
+	print_stats(theme.get_stats());
+	return 0;
+}
+
+void usage(char const * name)
+{
+	cerr << "usage: " << name << " parse [-n iterations] [file.desktop ...]" << endl;
+	cerr << "       " << name << " locale [-n iterations] [file.desktop ...]" << endl;
+	cerr << "       " << name << " scan [-n iterations] [threads]" << endl;
+	cerr << "       " << name << " cache [-n iterations]" << endl;
+	cerr << "       " << name << " icons-mt [-n iterations] [theme [icon ...]]" << endl;
+	cerr << "       " << name << " icons-batch [-n iterations] [theme [icon ...]]" << endl;
+	cerr << "       " << name << " startup [-n iterations] [theme [icon ...]]" << endl;
+	cerr << "       " << name << " subdirs [-n iterations] [theme]" << endl;
+	cerr << "       " << name << " convert [-n iterations] [theme]" << endl;
+	cerr << "       " << name << " stats [-n iterations] [theme [icon ...]]" << endl;
+	cerr << "       " << name << " memory [theme [icon ...]]" << endl;
+	cerr << "       " << name << " allocations [--max N] [theme [icon ...]]" << endl;
+}
+
+} // anonymous namespace
+
+int main(int argc, char ** argv)
+{
+	if (argc < 2) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	int iterations = 10;
+	vector<string> args;
+	for (int i = 2; i < argc; ++i) {
+		if (strcmp(argv[i], "-n") == 0 and i+1 < argc) {
+			iterations = atoi(argv[++i]);
+		} else {
+			args.push_back(argv[i]);
+		}
+	}
+
+	string cmd = argv[1];
+	if (cmd == "parse")
+		return bench_parse(args, iterations);
+	if (cmd == "locale")
+		return bench_locale(args, iterations);
+	if (cmd == "scan")
+		return bench_scan(args, iterations);
+	if (cmd == "cache")
+		return bench_cache(iterations);
+	if (cmd == "icons-mt")
+		return bench_icons_mt(args, iterations);
+	if (cmd == "icons-batch")
+		return bench_icons_batch(args, iterations);
+	if (cmd == "startup")
+		return bench_startup(args, iterations);
+	if (cmd == "subdirs")
+		return bench_subdirs(args, iterations);
+	if (cmd == "convert")
+		return bench_convert(args, iterations);
+	if (cmd == "stats")
+		return bench_stats(args, iterations);
+	if (cmd == "memory")
+		return bench_memory(args);
+	if (cmd == "allocations")
+		return bench_allocations(args);
+
+	usage(argv[0]);
+	return 1;
+}
@@ -0,0 +1,169 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <xdg-icon-theme.hxx>
+#include <xdg-stats.hxx>
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "bench-tree.hxx"
+
+using namespace std;
+
+#ifndef LIBXDG_ALLOCATION_ACCOUNTING
+
+/**
+ * Count allocations of the process, libxdg built with allocation
+ * accounting replaces operator new itself and counts them instead.
+ **/
+static atomic<size_t> g_allocations{0};
+
+// Out of line, thus the compiler does not pair malloc with operator delete.
+__attribute__((noinline)) static void * allocate(size_t size)
+{
+	return malloc(size?size:1);
+}
+
+__attribute__((noinline)) static void deallocate(void * p)
+{
+	free(p);
+}
+
+void * operator new(size_t size)
+{
+	void * p = allocate(size);
+	if (p == nullptr)
+		throw bad_alloc{};
+	g_allocations.fetch_add(1, memory_order_relaxed);
+	return p;
+}
+
+void * operator new(size_t size, nothrow_t const &) noexcept
+{
+	try {
+		return operator new(size);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+void operator delete(void * p) noexcept
+{
+	deallocate(p);
+}
+
+void operator delete(void * p, nothrow_t const &) noexcept
+{
+	operator delete(p);
+}
+
+// Sized form, called by code built as C++14 or later.
+void operator delete(void * p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+static size_t allocations()
+{
+	return g_allocations.load(memory_order_relaxed);
+}
+
+#else
+
+static size_t allocations()
+{
+	return xdg::get_allocation_stats().allocations;
+}
+
+#endif
+
+namespace {
+
+/**
+ * Highest allocations per find_icon call once the theme is loaded. A hit
+ * returns one path, with or without the result cache. Misses return undef
+ * within the small string buffer.
+ **/
+double const max_uncached = 1.0;
+double const max_cached = max_uncached;
+
+// Average allocations of find_icon over names at a few sizes.
+double allocations_per_lookup(xdg::theme const & theme, vector<string> const & names)
+{
+	size_t lookups = 0;
+	size_t start = allocations();
+	for (auto & n: names) {
+		for (auto size: {16, 24, 48, 96}) {
+			theme.find_icon(n, size, 1);
+			lookups += 1;
+		}
+	}
+	return static_cast<double>(allocations()-start)/lookups;
+}
+
+} // anonymous namespace
+
+int main()
+{
+	bench_tree::shape shape;
+	shape.subdirs = 20;
+	shape.icons = 20;
+	shape.applications = 0;
+
+	char const * TMPDIR = getenv("TMPDIR");
+	string root = bench_tree::create_root(TMPDIR?TMPDIR:"/tmp");
+	if (root.empty()) {
+		cerr << "ERROR: cannot create a temporary directory" << endl;
+		return 1;
+	}
+	bench_tree::generate(shape, root);
+	bench_tree::use_tree(root, "C");
+
+	// Hits in every theme of the chain, then misses.
+	vector<string> names;
+	for (int t = 0; t <= shape.themes; ++t)
+		for (int i = 0; i < shape.icons; ++i)
+			names.push_back(bench_tree::icon_name(t, i));
+	for (int i = 0; i < shape.icons; ++i)
+		names.push_back("bench-missing-"+to_string(i));
+
+	int ret = 0;
+	for (auto cache_capacity: {size_t{0}, xdg::theme::default_cache_capacity}) {
+		xdg::theme theme{bench_tree::theme_name(shape, 0), cache_capacity};
+		// Load lazy parts and fill the cache first.
+		allocations_per_lookup(theme, names);
+		double average = allocations_per_lookup(theme, names);
+		double max = cache_capacity?max_cached:max_uncached;
+		char const * name = cache_capacity?"find_icon, cached":"find_icon";
+		cout << name << ": " << average << " allocations/lookup, max " << max << endl;
+		if (average > max) {
+			cerr << "FAIL: " << name << " allocates more than " << max << " times per lookup" << endl;
+			ret = 1;
+		}
+	}
+
+	bench_tree::remove_tree(root);
+	return ret;
+}
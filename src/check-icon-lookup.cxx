@@ -0,0 +1,188 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <xdg-icon-theme.hxx>
+#include <iostream>
+#include <vector>
+#include <limits>
+#include <cstdlib>
+
+#include "bench-tree.hxx"
+
+using namespace std;
+
+namespace {
+
+int const int_min = numeric_limits<int>::min();
+int const int_max = numeric_limits<int>::max();
+
+// Sizes and scales at the edges of the int range, besides usual ones.
+int const sizes[] = {int_min, int_min+1, -1, 0, 1, 16, 47, 48, 600, int_max-1, int_max};
+int const scales[] = {int_min, -1, 0, 1, 2, int_max};
+
+/**
+ * Theme whose only subdir has Size=0, no subdir is close to any size
+ * thus lookups go on with the inherited themes.
+ **/
+void generate_zero_theme(string const & root)
+{
+	string dir = root+"/share/icons/check-zero";
+	bench_tree::make_directory(dir+"/0x0");
+	bench_tree::write_file(dir+"/0x0/foo.png", "");
+	bench_tree::write_file(dir+"/index.theme",
+		"[Icon Theme]\nName=check-zero\nInherits=hicolor\nDirectories=0x0\n\n"
+		"[0x0]\nSize=0\nType=Fixed\n");
+}
+
+/**
+ * Theme whose subdirs of every type overlap at several scales, for the
+ * segments of icon_size_table.
+ **/
+void generate_mixed_theme(string const & root)
+{
+	struct {
+		char const * name;
+		char const * rule;
+		char const * icons[3];
+	} const subdirs[] = {
+		{"16x16", "Size=16\nType=Threshold\n", {"mix-a", "mix-c", nullptr}},
+		{"16x16@2", "Size=16\nScale=2\nType=Threshold\nThreshold=3\n", {"mix-a", "mix-b", nullptr}},
+		{"24x24", "Size=24\nType=Fixed\n", {"mix-a", "mix-c", nullptr}},
+		{"32x32", "Size=32\nType=Threshold\nThreshold=5\n", {"mix-a", nullptr, nullptr}},
+		{"48x48@3", "Size=48\nScale=3\nType=Fixed\n", {"mix-a", "mix-b", nullptr}},
+		{"scalable", "Size=64\nMinSize=40\nMaxSize=256\nType=Scalable\n", {"mix-a", "mix-c", nullptr}},
+		{"100x100", "Size=100\nType=Threshold\nThreshold=0\n", {"mix-a", "mix-b", "mix-c"}},
+	};
+
+	string dir = root+"/share/icons/check-mixed";
+	string directories;
+	string groups;
+	for (auto & d: subdirs) {
+		directories += directories.empty()?"":",";
+		directories += d.name;
+		groups += string{"\n["}+d.name+"]\n"+d.rule;
+		bench_tree::make_directory(dir+"/"+d.name);
+		for (auto icon: d.icons) {
+			if (icon)
+				bench_tree::write_file(dir+"/"+d.name+"/"+icon+".png", "");
+		}
+	}
+	bench_tree::write_file(dir+"/index.theme",
+		"[Icon Theme]\nName=check-mixed\nInherits=hicolor\nDirectories="+directories+"\n"+groups);
+}
+
+// Compare find_icons with find_icon for each name at every size and scale.
+int check_find_icons(string const & theme_name, vector<string> const & names)
+{
+	xdg::theme theme{theme_name, 0};
+	vector<xdg::icon_request> requests;
+	for (auto & n: names) {
+		for (auto size: sizes) {
+			for (auto scale: scales)
+				requests.push_back(xdg::icon_request{n, size, scale});
+		}
+	}
+
+	int ret = 0;
+	auto results = theme.find_icons(requests);
+	for (size_t i = 0; i < requests.size(); ++i) {
+		auto & r = requests[i];
+		auto expected = theme.find_icon(r.name, r.size, r.scale);
+		if (results[i] != expected) {
+			cerr << "FAIL: " << theme_name << ": find_icons(" << r.name << ", " << r.size << ", " << r.scale
+					<< ") returned " << results[i] << " instead of " << expected << endl;
+			ret = 1;
+		}
+	}
+	cout << theme_name << ": " << requests.size() << " find_icons results checked" << endl;
+	return ret;
+}
+
+/**
+ * Compare icon_size_table::lookup with find_icon for each name, over
+ * sizes -2 to 600 at scales 1 to 3.
+ **/
+int check_icon_sizes(string const & theme_name, vector<string> const & names)
+{
+	xdg::theme theme{theme_name, 0};
+	int ret = 0;
+	size_t count = 0;
+	for (auto & n: names) {
+		auto table = theme.icon_sizes(n);
+		for (int scale = 1; scale <= 3; ++scale) {
+			for (int size = -2; size <= 600; ++size) {
+				auto expected = theme.find_icon(n, size, scale);
+				auto & result = table.lookup(size, scale);
+				count += 1;
+				if (result != expected) {
+					cerr << "FAIL: " << theme_name << ": icon_sizes(" << n << ").lookup(" << size << ", " << scale
+							<< ") returned " << result << " instead of " << expected << endl;
+					ret = 1;
+				}
+			}
+		}
+	}
+	cout << theme_name << ": " << count << " icon_sizes lookups checked" << endl;
+	return ret;
+}
+
+} // anonymous namespace
+
+int main()
+{
+	bench_tree::shape shape;
+	shape.themes = 2;
+	shape.subdirs = 40;
+	shape.icons = 4;
+	shape.applications = 0;
+
+	char const * TMPDIR = getenv("TMPDIR");
+	string root = bench_tree::create_root(TMPDIR?TMPDIR:"/tmp");
+	if (root.empty()) {
+		cerr << "ERROR: cannot create a temporary directory" << endl;
+		return 1;
+	}
+	bench_tree::generate(shape, root);
+	generate_zero_theme(root);
+	generate_mixed_theme(root);
+	bench_tree::use_tree(root, "C");
+
+	// Icons of every theme of the chain, one missing and the one of check-zero.
+	vector<string> names;
+	for (int t = 0; t <= shape.themes; ++t)
+		names.push_back(bench_tree::icon_name(t, 0));
+	names.push_back("bench-missing");
+	names.push_back("foo");
+	for (auto n: {"mix-a", "mix-b", "mix-c"})
+		names.push_back(n);
+
+	int ret = 0;
+	ret |= check_find_icons(bench_tree::theme_name(shape, 0), names);
+	ret |= check_find_icons("check-zero", names);
+	ret |= check_find_icons("check-mixed", names);
+	ret |= check_icon_sizes(bench_tree::theme_name(shape, 0), names);
+	ret |= check_icon_sizes("check-zero", names);
+	ret |= check_icon_sizes("check-mixed", names);
+
+	bench_tree::remove_tree(root);
+	return ret;
+}
@@ -0,0 +1,312 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <xdg-icon-theme.hxx>
+#include <xdg-application-set.hxx>
+#include <xdg-watcher.hxx>
+#include <iostream>
+#include <memory>
+#include <map>
+#include <cstring>
+#include <cerrno>
+
+#include "xdg-utils.hxx"
+#include "xdg-icon-protocol.hxx"
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+using namespace std;
+
+namespace {
+
+/**
+ * Serve icon and application lookups to icon_client, see
+ * xdg-icon-protocol.hxx. Themes and application sets are built on the
+ * first request that needs them, then kept up to date by a watcher.
+ **/
+class icon_server {
+
+	struct connection {
+		string input;
+		string output;
+	};
+
+	int _listen_fd;
+	xdg::watcher _watcher;
+	map<string, unique_ptr<xdg::theme>> _themes;
+	map<string, unique_ptr<xdg::application_set>> _applications;
+	map<int, connection> _connections;
+
+	xdg::theme & _get_theme(string const & identifier)
+	{
+		auto & ret = _themes[identifier];
+		if (not ret) {
+			ret.reset(new xdg::theme{identifier});
+			_watcher.add(*ret);
+		}
+		return *ret;
+	}
+
+	xdg::application_set & _get_applications(string const & lang)
+	{
+		auto & ret = _applications[lang];
+		if (not ret) {
+			ret.reset(new xdg::application_set{lang});
+			_watcher.add(*ret);
+		}
+		return *ret;
+	}
+
+	void _apps(string const & lang, string const & key_list, string & out)
+	{
+		vector<string> keys;
+		if (not key_list.empty())
+			keys = xdg::split(key_list, ',');
+		for (auto & x: _get_applications(lang).applications()) {
+			if (not xdg::icon_protocol::is_valid_field(x.first))
+				continue;
+			out.append("file\t").append(x.first).append(1, '\n');
+			auto g = x.second.find("Desktop Entry");
+			if (g == x.second.end())
+				continue;
+			for (auto & e: g->second) {
+				if (keys.empty() or find(keys.begin(), keys.end(), e.first) != keys.end())
+					out.append(e.first).append(1, '\t').append(e.second.data).append(1, '\n');
+			}
+		}
+		out.append("end\n");
+	}
+
+	void _handle(string const & line, string & out)
+	{
+		auto fields = xdg::split(line, '\t');
+		if (fields[0] == "icon" and fields.size() == 5) {
+			out.append(_get_theme(fields[1]).find_icon(fields[4],
+					atoi(fields[2].c_str()), atoi(fields[3].c_str())));
+			out.append(1, '\n');
+		} else if (fields[0] == "apps" and fields.size() == 3) {
+			_apps(fields[1], fields[2], out);
+		} else {
+			out.append("error\n");
+		}
+	}
+
+	void _accept()
+	{
+		int fd = accept4(_listen_fd, nullptr, nullptr, SOCK_NONBLOCK|SOCK_CLOEXEC);
+		if (fd < 0)
+			return;
+		if (not xdg::icon_protocol::is_same_user(fd)) {
+			close(fd);
+			return;
+		}
+		_connections[fd];
+	}
+
+	static bool _output_full(connection const & c)
+	{
+		return c.output.size() >= xdg::icon_protocol::max_pending_output;
+	}
+
+	// Answer complete requests until the output is full, return false on a too long request.
+	bool _process(connection & c)
+	{
+		size_t begin = 0;
+		for (auto eol = c.input.find('\n'); eol != string::npos and not _output_full(c);
+				eol = c.input.find('\n', begin)) {
+			_handle(c.input.substr(begin, eol-begin), c.output);
+			begin = eol+1;
+		}
+		c.input.erase(0, begin);
+		return c.input.find('\n') != string::npos or c.input.size() <= xdg::icon_protocol::max_request_size;
+	}
+
+	// Return false when the connection is closed.
+	bool _read(int fd, connection & c)
+	{
+		char buffer[16384];
+		// Unread requests wait in the socket while the client does not read answers.
+		while (not _output_full(c)) {
+			auto n = recv(fd, buffer, sizeof buffer, 0);
+			if (n < 0 and errno == EINTR)
+				continue;
+			if (n < 0)
+				return errno == EAGAIN or errno == EWOULDBLOCK;
+			if (n == 0)
+				return false;
+			c.input.append(buffer, n);
+			if (not _process(c))
+				return false;
+		}
+		return true;
+	}
+
+	bool _write(int fd, connection & c)
+	{
+		while (not c.output.empty()) {
+			auto n = send(fd, c.output.data(), c.output.size(), MSG_NOSIGNAL);
+			if (n < 0 and errno == EINTR)
+				continue;
+			if (n < 0)
+				return errno == EAGAIN or errno == EWOULDBLOCK;
+			c.output.erase(0, n);
+		}
+		return true;
+	}
+
+public:
+
+	icon_server(string const & socket_path) : _listen_fd{-1}
+	{
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof addr);
+		addr.sun_family = AF_UNIX;
+		if (socket_path.size() >= sizeof addr.sun_path)
+			throw runtime_error("socket path too long");
+		memcpy(addr.sun_path, socket_path.c_str(), socket_path.size()+1);
+
+		_listen_fd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+		if (_listen_fd < 0)
+			throw runtime_error("socket failed");
+
+		// A socket nobody listens to was left by a previous server.
+		if (connect(_listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) == 0)
+			throw runtime_error("a server is already running on "+socket_path);
+		close(_listen_fd);
+		unlink(socket_path.c_str());
+
+		_listen_fd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+		auto old_mask = umask(0077);
+		int err = bind(_listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr);
+		umask(old_mask);
+		if (err != 0 or listen(_listen_fd, 64) != 0)
+			throw runtime_error("cannot listen on "+socket_path);
+	}
+
+	~icon_server()
+	{
+		for (auto & c: _connections)
+			close(c.first);
+		close(_listen_fd);
+	}
+
+	void preload(string const & identifier)
+	{
+		_get_theme(identifier);
+	}
+
+	void run()
+	{
+		vector<pollfd> fds;
+		for (;;) {
+			fds.clear();
+			fds.push_back(pollfd{_listen_fd, POLLIN, 0});
+			fds.push_back(pollfd{_watcher.fd(), POLLIN, 0});
+			for (auto & c: _connections) {
+				short events = _output_full(c.second)?0:POLLIN;
+				if (not c.second.output.empty())
+					events |= POLLOUT;
+				fds.push_back(pollfd{c.first, events, 0});
+			}
+
+			if (poll(fds.data(), fds.size(), -1) < 0) {
+				if (errno == EINTR)
+					continue;
+				throw runtime_error("poll failed");
+			}
+
+			if (fds[0].revents & POLLIN)
+				_accept();
+			if (fds[1].revents & POLLIN)
+				_watcher.dispatch();
+
+			for (size_t i = 2; i < fds.size(); ++i) {
+				if (fds[i].revents == 0)
+					continue;
+				int fd = fds[i].fd;
+				auto & c = _connections[fd];
+				bool alive = not (fds[i].revents & (POLLERR|POLLNVAL));
+				if (alive and (fds[i].revents & (POLLIN|POLLHUP)))
+					alive = _read(fd, c);
+				if (alive)
+					alive = _write(fd, c);
+				// Requests left aside while the output was full.
+				if (alive and not _output_full(c) and not c.input.empty()) {
+					alive = _process(c);
+					if (alive)
+						alive = _write(fd, c);
+				}
+				if (not alive) {
+					close(fd);
+					_connections.erase(fd);
+				}
+			}
+		}
+	}
+
+};
+
+void usage(char const * name)
+{
+	cerr << "usage: " << name << " [--socket path] [theme ...]" << endl;
+	cerr << endl;
+	cerr << "Serve icon and application lookups to libxdg clients, listed themes are" << endl;
+	cerr << "loaded at startup, the others on first request." << endl;
+}
+
+} // anonymous namespace
+
+int main(int argc, char ** argv)
+{
+	string socket_path = xdg::icon_protocol::default_socket_path();
+	vector<string> themes;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--socket") == 0 and i+1 < argc) {
+			socket_path = argv[++i];
+		} else if (argv[i][0] == '-') {
+			usage(argv[0]);
+			return 1;
+		} else {
+			themes.push_back(argv[i]);
+		}
+	}
+
+	try {
+		icon_server server{socket_path};
+		for (auto & t: themes)
+			server.preload(t);
+		server.run();
+	} catch (exception & e) {
+		cerr << "ERROR: " << e.what() << endl;
+		return 1;
+	}
+
+	return 0;
+}
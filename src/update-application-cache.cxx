@@ -0,0 +1,43 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <xdg-application-cache.hxx>
+#include <iostream>
+
+#include "xdg-utils.hxx"
+
+using namespace std;
+
+int main(int argc, char ** argv)
+{
+	// Default to the current locale, the cache is per locale.
+	string lang = argc > 1?argv[1]:xdg::getenv_lang();
+
+	xdg::application_cache::stats st;
+	xdg::application_cache::list_all_applications(lang, &st);
+
+	cout << xdg::application_cache::filename(lang) << ": "
+			<< st.files << " applications, "
+			<< st.reparsed_directories << "/" << st.directories << " directories parsed, "
+			<< (st.written?"updated":"up to date") << endl;
+
+	return 0;
+}
@@ -0,0 +1,246 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "xdg-allocation.hxx"
+
+#include <cstdlib>
+#include <new>
+
+namespace xdg {
+
+using namespace std;
+
+namespace {
+
+// Every allocation of the process, constant initialized.
+allocation_account process_account;
+
+auto unreference(allocation_account * account) -> void
+{
+	if (account->references.fetch_sub(1, memory_order_acq_rel) == 1) {
+		account->~allocation_account();
+		free(account);
+	}
+}
+
+} // anonymous namespace
+
+allocation_account * allocation_account::create()
+{
+	void * p = malloc(sizeof(allocation_account));
+	if (p == nullptr)
+		throw bad_alloc{};
+	return new (p) allocation_account;
+}
+
+void allocation_account::release()
+{
+	unreference(this);
+}
+
+allocation_stats allocation_account::get() const
+{
+	allocation_stats ret;
+	ret.allocations = allocations.load(memory_order_relaxed);
+	ret.deallocations = deallocations.load(memory_order_relaxed);
+	ret.bytes = bytes.load(memory_order_relaxed);
+	ret.live_bytes = live_bytes.load(memory_order_relaxed);
+	ret.peak_bytes = peak_bytes.load(memory_order_relaxed);
+	return ret;
+}
+
+void allocation_account::reset()
+{
+	allocations = 0;
+	deallocations = 0;
+	bytes = 0;
+	peak_bytes = live_bytes.load(memory_order_relaxed);
+}
+
+bool allocation_accounting_enabled()
+{
+#ifdef LIBXDG_ALLOCATION_ACCOUNTING
+	return true;
+#else
+	return false;
+#endif
+}
+
+allocation_stats get_allocation_stats()
+{
+	return process_account.get();
+}
+
+void reset_allocation_stats()
+{
+	process_account.reset();
+}
+
+#ifdef LIBXDG_ALLOCATION_ACCOUNTING
+
+namespace {
+
+thread_local allocation_account * current_account = nullptr;
+
+/**
+ * Just before each user block, 16 bytes thus the user block keeps the
+ * alignment of malloc. Blocks allocated before libxdg replaced operator
+ * new, when it is dlopened, have no header: the 16 bytes before them are
+ * the chunk header of glibc malloc, whose size field never has any of the
+ * 16 high bits set, thus the magic tells them apart.
+ **/
+struct block_header {
+	allocation_account * account;
+	uint64_t size_and_magic;
+};
+
+uint64_t const magic = uint64_t{0xa110} << 48;
+uint64_t const size_mask = (uint64_t{1} << 48)-1;
+
+auto allocate(size_t size) noexcept -> void *
+{
+	if (size > size_mask)
+		return nullptr;
+	auto h = static_cast<block_header *>(malloc(sizeof(block_header)+size));
+	if (h == nullptr)
+		return nullptr;
+	auto account = current_account;
+	h->account = account;
+	h->size_and_magic = magic | size;
+	process_account.charge(size);
+	if (account) {
+		account->references.fetch_add(1, memory_order_relaxed);
+		account->charge(size);
+	}
+	return h+1;
+}
+
+auto deallocate(void * p) noexcept -> void
+{
+	if (p == nullptr)
+		return;
+	auto h = static_cast<block_header *>(p)-1;
+	if ((h->size_and_magic & ~size_mask) != magic) {
+		// Not ours, from the operator new in place before libxdg was loaded.
+		free(p);
+		return;
+	}
+	size_t size = h->size_and_magic & size_mask;
+	// A stale magic must not match once the block is reused by malloc.
+	h->size_and_magic = 0;
+	process_account.discharge(size);
+	if (h->account) {
+		h->account->discharge(size);
+		unreference(h->account);
+	}
+	free(h);
+}
+
+// Same loop as the default operator new.
+auto allocate_or_throw(size_t size) -> void *
+{
+	for (;;) {
+		void * p = allocate(size);
+		if (p)
+			return p;
+		auto handler = get_new_handler();
+		if (handler == nullptr)
+			throw bad_alloc{};
+		handler();
+	}
+}
+
+} // anonymous namespace
+
+scoped_allocation_account::scoped_allocation_account(allocation_account * account) :
+	_previous{current_account}
+{
+	current_account = account;
+}
+
+scoped_allocation_account::~scoped_allocation_account()
+{
+	current_account = _previous;
+}
+
+#endif
+
+} // namespace xdg
+
+#ifdef LIBXDG_ALLOCATION_ACCOUNTING
+
+void * operator new(std::size_t size)
+{
+	return xdg::allocate_or_throw(size);
+}
+
+void * operator new[](std::size_t size)
+{
+	return xdg::allocate_or_throw(size);
+}
+
+void * operator new(std::size_t size, std::nothrow_t const &) noexcept
+{
+	try {
+		return xdg::allocate_or_throw(size);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+void * operator new[](std::size_t size, std::nothrow_t const &) noexcept
+{
+	return operator new(size, std::nothrow);
+}
+
+void operator delete(void * p) noexcept
+{
+	xdg::deallocate(p);
+}
+
+void operator delete[](void * p) noexcept
+{
+	xdg::deallocate(p);
+}
+
+void operator delete(void * p, std::nothrow_t const &) noexcept
+{
+	xdg::deallocate(p);
+}
+
+void operator delete[](void * p, std::nothrow_t const &) noexcept
+{
+	xdg::deallocate(p);
+}
+
+// Sized forms, called by code built as C++14 or later.
+void operator delete(void * p, std::size_t) noexcept
+{
+	xdg::deallocate(p);
+}
+
+void operator delete[](void * p, std::size_t) noexcept
+{
+	xdg::deallocate(p);
+}
+
+#endif
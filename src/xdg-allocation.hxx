@@ -0,0 +1,112 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef SRC_XDG_ALLOCATION_HXX_
+#define SRC_XDG_ALLOCATION_HXX_
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#include "xdg-stats.hxx"
+
+namespace xdg {
+
+/**
+ * Allocations charged to a theme or to application listing. With
+ * LIBXDG_ALLOCATION_ACCOUNTING, libxdg replaces the global operator new
+ * and delete, each block records the account active in its thread when
+ * it was allocated, thus frees are charged back to that account from any
+ * thread. Blocks keep their account alive, an account is freed once its
+ * owner released it and all its blocks are freed.
+ *
+ * Accounting builds are meant to be linked at startup: when libxdg is
+ * dlopened, blocks allocated before are recognized and given back to
+ * free as long as malloc is the one of glibc, but they are not counted.
+ **/
+struct allocation_account {
+	std::atomic<uint64_t> allocations;
+	std::atomic<uint64_t> deallocations;
+	std::atomic<uint64_t> bytes;
+	std::atomic<uint64_t> live_bytes;
+	std::atomic<uint64_t> peak_bytes;
+	std::atomic<size_t> references;
+
+	constexpr allocation_account() : allocations{0}, deallocations{0},
+		bytes{0}, live_bytes{0}, peak_bytes{0}, references{1} { }
+
+	allocation_account(allocation_account const &) = delete;
+	allocation_account & operator=(allocation_account const &) = delete;
+
+	// Not allocated with operator new, thus not accounted.
+	static allocation_account * create();
+
+	// Drop the owner reference.
+	void release();
+
+	void charge(size_t size)
+	{
+		allocations.fetch_add(1, std::memory_order_relaxed);
+		bytes.fetch_add(size, std::memory_order_relaxed);
+		uint64_t live = live_bytes.fetch_add(size, std::memory_order_relaxed)+size;
+		uint64_t peak = peak_bytes.load(std::memory_order_relaxed);
+		while (live > peak and not peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) { }
+	}
+
+	void discharge(size_t size)
+	{
+		deallocations.fetch_add(1, std::memory_order_relaxed);
+		live_bytes.fetch_sub(size, std::memory_order_relaxed);
+	}
+
+	allocation_stats get() const;
+
+	// Live blocks are still accounted, the peak restart from them.
+	void reset();
+
+};
+
+/**
+ * Charge allocations of the current thread to account until the end of
+ * the scope, callbacks of the user called within the scope are charged
+ * too. Scopes can be nested, the innermost wins. No-op unless built with
+ * LIBXDG_ALLOCATION_ACCOUNTING.
+ **/
+class scoped_allocation_account {
+#ifdef LIBXDG_ALLOCATION_ACCOUNTING
+	allocation_account * _previous;
+
+public:
+	scoped_allocation_account(allocation_account * account);
+	~scoped_allocation_account();
+#else
+public:
+	scoped_allocation_account(allocation_account *) { }
+#endif
+
+	scoped_allocation_account(scoped_allocation_account const &) = delete;
+	scoped_allocation_account & operator=(scoped_allocation_account const &) = delete;
+};
+
+} // namespace xdg
+
+#endif /* SRC_XDG_ALLOCATION_HXX_ */
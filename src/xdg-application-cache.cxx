@@ -0,0 +1,549 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "xdg-application-cache.hxx"
+#include "xdg-application-scan.hxx"
+#include "xdg-batch-read.hxx"
+#include "xdg-utils.hxx"
+#include "xdg-string-arena.hxx"
+#include "xdg-stats-counters.hxx"
+
+#include <cstring>
+#include <cstdio>
+#include <limits>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+namespace xdg {
+
+using namespace std;
+
+namespace {
+
+/*
+ * Cache file layout, native endian, every table is 8 bytes aligned and
+ * all offsets are from the start of the file:
+ *
+ *   cache_header
+ *   cache_directory[n_directories] in scan order
+ *   cache_string[n_subdirs]        subdir names of each directory
+ *   cache_file[n_files]            desktop files of each directory
+ *   cache_group[n_groups]
+ *   cache_entry[n_entries]
+ *   string pool
+ */
+
+char const cache_magic[8] = {'X', 'D', 'G', 'A', 'P', 'P', 'C', '\0'};
+uint32_t const cache_byte_order = 0x01020304u;
+// 2: localized keys are selected as defined by the desktop entry spec.
+// 3: scan in precedence order, shadowed files are listed but not parsed.
+uint32_t const cache_version = 3;
+
+struct cache_string {
+	uint32_t offset;
+	uint32_t length;
+};
+
+struct cache_header {
+	char magic[8];
+	uint32_t byte_order;
+	uint32_t version;
+	cache_string lang;
+	uint32_t n_directories;
+	uint32_t directories;
+	uint32_t n_subdirs;
+	uint32_t subdirs;
+	uint32_t n_files;
+	uint32_t files;
+	uint32_t n_groups;
+	uint32_t groups;
+	uint32_t n_entries;
+	uint32_t entries;
+};
+
+struct cache_directory {
+	cache_string path;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint32_t first_subdir;
+	uint32_t n_subdirs;
+	uint32_t first_file;
+	uint32_t n_files;
+};
+
+struct cache_file {
+	cache_string name; //< relative to its directory.
+	uint32_t first_group;
+	uint32_t n_groups;
+	uint32_t flags;
+	uint32_t padding;
+};
+
+enum : uint32_t {
+	CACHE_FILE_SHADOWED = 1 << 0 //< not parsed, no groups.
+};
+
+struct cache_group {
+	cache_string name;
+	uint32_t first_entry;
+	uint32_t n_entries;
+};
+
+struct cache_entry {
+	cache_string key;
+	cache_string value;
+	int32_t score;
+	uint32_t padding;
+};
+
+size_t align8(size_t x)
+{
+	return (x+7u)&~size_t{7u};
+}
+
+/**
+ * Validated view of a mapped cache file.
+ **/
+struct cache_reader {
+	shared_ptr<mapped_desktop_file::mapping const> map;
+	cache_header const * header;
+
+	cache_reader() : header{nullptr} { }
+
+	template<typename T>
+	bool _table(uint32_t offset, uint32_t count) const
+	{
+		return offset%8 == 0 and offset <= map->size
+				and uint64_t{count}*sizeof(T) <= map->size-offset;
+	}
+
+	bool _string(cache_string const & s) const
+	{
+		return s.offset <= map->size and s.length <= map->size-s.offset;
+	}
+
+	template<typename T>
+	T const * table(uint32_t offset) const
+	{
+		return reinterpret_cast<T const *>(map->data+offset);
+	}
+
+	string_view str(cache_string const & s) const
+	{
+		return string_view{map->data+s.offset, s.length};
+	}
+
+	bool open(string const & filename, string const & lang)
+	{
+		map = make_shared<mapped_desktop_file::mapping>(filename);
+		if (map->data == nullptr or map->size < sizeof(cache_header))
+			return false;
+
+		auto h = reinterpret_cast<cache_header const *>(map->data);
+		if (memcmp(h->magic, cache_magic, sizeof cache_magic) != 0
+				or h->byte_order != cache_byte_order
+				or h->version != cache_version
+				or not _string(h->lang))
+			return false;
+
+		header = h;
+		if (str(h->lang) != lang)
+			return false;
+
+		if (not _table<cache_directory>(h->directories, h->n_directories)
+				or not _table<cache_string>(h->subdirs, h->n_subdirs)
+				or not _table<cache_file>(h->files, h->n_files)
+				or not _table<cache_group>(h->groups, h->n_groups)
+				or not _table<cache_entry>(h->entries, h->n_entries))
+			return false;
+
+		// Check every reference once, thus readers do not have to.
+		for (uint32_t i = 0; i < h->n_directories; ++i) {
+			auto & d = table<cache_directory>(h->directories)[i];
+			if (not _string(d.path)
+					or d.first_subdir > h->n_subdirs or d.n_subdirs > h->n_subdirs-d.first_subdir
+					or d.first_file > h->n_files or d.n_files > h->n_files-d.first_file)
+				return false;
+		}
+
+		for (uint32_t i = 0; i < h->n_subdirs; ++i) {
+			if (not _string(table<cache_string>(h->subdirs)[i]))
+				return false;
+		}
+
+		for (uint32_t i = 0; i < h->n_files; ++i) {
+			auto & f = table<cache_file>(h->files)[i];
+			if (not _string(f.name) or f.first_group > h->n_groups
+					or f.n_groups > h->n_groups-f.first_group)
+				return false;
+		}
+
+		for (uint32_t i = 0; i < h->n_groups; ++i) {
+			auto & g = table<cache_group>(h->groups)[i];
+			if (not _string(g.name) or g.first_entry > h->n_entries
+					or g.n_entries > h->n_entries-g.first_entry)
+				return false;
+		}
+
+		for (uint32_t i = 0; i < h->n_entries; ++i) {
+			auto & e = table<cache_entry>(h->entries)[i];
+			if (not _string(e.key) or not _string(e.value))
+				return false;
+		}
+
+		return true;
+	}
+
+	mapped_desktop_file load_file(string const & dirname, cache_file const & f) const
+	{
+		string filename;
+		auto name = str(f.name);
+		filename.reserve(dirname.size()+name.size()+1);
+		filename.append(dirname).append(1, '/').append(name.data(), name.size());
+		mapped_desktop_file ret{filename, map};
+		ret.reserve(f.n_groups);
+		for (uint32_t i = f.first_group; i < f.first_group+f.n_groups; ++i) {
+			auto & g = table<cache_group>(header->groups)[i];
+			auto & group = ret[str(g.name)];
+			group.reserve(g.n_entries);
+			for (uint32_t j = g.first_entry; j < g.first_entry+g.n_entries; ++j) {
+				auto & e = table<cache_entry>(header->entries)[j];
+				group.push_back(mapped_entry{e.score, str(e.key), str(e.value)});
+			}
+		}
+		return ret;
+	}
+
+};
+
+struct scanned_file {
+	string name;
+	size_t index; //< within the result list, npos if shadowed.
+};
+
+struct scanned_directory {
+	application_directory dir;
+	struct timespec mtime;
+	vector<string> subdirs;
+	vector<scanned_file> files;
+};
+
+struct cache_writer {
+	string pool;
+	// Group names, keys and values repeat a lot, each is stored once.
+	string_arena interned_data;
+	unordered_map<string_view, cache_string> interned;
+	vector<cache_directory> directories;
+	vector<cache_string> subdirs;
+	vector<cache_file> files;
+	vector<cache_group> groups;
+	vector<cache_entry> entries;
+
+	// Offsets are relative to the pool until write() relocate them.
+	cache_string add(string_view const & s)
+	{
+		auto x = interned.find(s);
+		if (x != interned.end())
+			return x->second;
+		cache_string ret{static_cast<uint32_t>(pool.size()), static_cast<uint32_t>(s.size())};
+		pool.append(s.data(), s.size());
+		interned.emplace(interned_data.store(s), ret);
+		return ret;
+	}
+
+	void add_directory(scanned_directory const & d, vector<mapped_desktop_file> const & list)
+	{
+		cache_directory x;
+		x.path = add(d.dir.path);
+		x.mtime_sec = d.mtime.tv_sec;
+		x.mtime_nsec = d.mtime.tv_nsec;
+		x.first_subdir = subdirs.size();
+		x.n_subdirs = d.subdirs.size();
+		x.first_file = files.size();
+		x.n_files = d.files.size();
+		directories.push_back(x);
+
+		for (auto & s: d.subdirs)
+			subdirs.push_back(add(s));
+
+		for (auto & scanned: d.files) {
+			cache_file f;
+			f.name = add(scanned.name);
+			f.first_group = groups.size();
+			f.n_groups = 0;
+			f.flags = 0;
+			f.padding = 0;
+			if (scanned.index == string::npos) {
+				f.flags = CACHE_FILE_SHADOWED;
+				files.push_back(f);
+				continue;
+			}
+			auto & file = list[scanned.index];
+			f.n_groups = file.size();
+			files.push_back(f);
+			for (auto & g: file) {
+				groups.push_back(cache_group{add(g.first), static_cast<uint32_t>(entries.size()),
+					static_cast<uint32_t>(g.second.size())});
+				for (auto & e: g.second)
+					entries.push_back(cache_entry{add(e.key), add(e.data), e.score, 0});
+			}
+		}
+	}
+
+	template<typename T>
+	static void append(string & out, vector<T> const & table)
+	{
+		out.append(reinterpret_cast<char const *>(table.data()), table.size()*sizeof(T));
+		out.resize(align8(out.size()), '\0');
+	}
+
+	bool write(string const & filename, string const & lang)
+	{
+		cache_header h;
+		memset(&h, 0, sizeof h);
+		memcpy(h.magic, cache_magic, sizeof cache_magic);
+		h.byte_order = cache_byte_order;
+		h.version = cache_version;
+		h.lang = add(lang);
+
+		size_t offset = align8(sizeof h);
+		h.n_directories = directories.size();
+		h.directories = offset;
+		offset = align8(offset+directories.size()*sizeof(cache_directory));
+		h.n_subdirs = subdirs.size();
+		h.subdirs = offset;
+		offset = align8(offset+subdirs.size()*sizeof(cache_string));
+		h.n_files = files.size();
+		h.files = offset;
+		offset = align8(offset+files.size()*sizeof(cache_file));
+		h.n_groups = groups.size();
+		h.groups = offset;
+		offset = align8(offset+groups.size()*sizeof(cache_group));
+		h.n_entries = entries.size();
+		h.entries = offset;
+		offset = align8(offset+entries.size()*sizeof(cache_entry));
+
+		if (offset+pool.size() > numeric_limits<uint32_t>::max())
+			return false;
+
+		auto pool_offset = static_cast<uint32_t>(offset);
+		h.lang.offset += pool_offset;
+		for (auto & x: directories)
+			x.path.offset += pool_offset;
+		for (auto & x: subdirs)
+			x.offset += pool_offset;
+		for (auto & x: files)
+			x.name.offset += pool_offset;
+		for (auto & x: groups)
+			x.name.offset += pool_offset;
+		for (auto & x: entries) {
+			x.key.offset += pool_offset;
+			x.value.offset += pool_offset;
+		}
+
+		string out;
+		out.reserve(offset+pool.size());
+		out.append(reinterpret_cast<char const *>(&h), sizeof h);
+		out.resize(align8(out.size()), '\0');
+		append(out, directories);
+		append(out, subdirs);
+		append(out, files);
+		append(out, groups);
+		append(out, entries);
+		out.append(pool);
+
+		// Write a new file and rename it, current readers keep the old one.
+		string tmp = filename+".tmp."+to_string(getpid());
+		int fd = ::open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+		if (fd < 0)
+			return false;
+		size_t written = 0;
+		while (written < out.size()) {
+			auto n = ::write(fd, out.data()+written, out.size()-written);
+			if (n <= 0)
+				break;
+			written += n;
+		}
+		close(fd);
+		if (written != out.size() or rename(tmp.c_str(), filename.c_str()) != 0) {
+			unlink(tmp.c_str());
+			return false;
+		}
+		return true;
+	}
+
+};
+
+} // anonymous namespace
+
+string application_cache::filename(string const & lang)
+{
+	string dir;
+	char const * XDG_CACHE_HOME = std::getenv("XDG_CACHE_HOME");
+	if (XDG_CACHE_HOME and XDG_CACHE_HOME[0] == '/') {
+		dir = XDG_CACHE_HOME;
+	} else {
+		char const * HOME = std::getenv("HOME");
+		dir = string{HOME?HOME:""}+"/.cache";
+	}
+
+	string name = lang.empty()?"C":lang;
+	replace(name.begin(), name.end(), '/', '_');
+	return dir+"/libxdg/applications-"+name+".cache";
+}
+
+vector<mapped_desktop_file> application_cache::list_all_applications(string const & lang, stats * st)
+{
+	stats tmp_stats;
+	if (st == nullptr)
+		st = &tmp_stats;
+	memset(st, 0, sizeof *st);
+
+	auto & counters = application_stats();
+	scoped_timer timer{counters.scan};
+	scoped_allocation_account account{counters.allocations};
+
+	string cache_filename = filename(lang);
+
+	cache_reader cache;
+	unordered_map<string_view, cache_directory const *> cached_directories;
+	if (cache.open(cache_filename, lang)) {
+		auto dirs = cache.table<cache_directory>(cache.header->directories);
+		for (uint32_t i = 0; i < cache.header->n_directories; ++i)
+			cached_directories[cache.str(dirs[i].path)] = &dirs[i];
+	}
+
+	locale_matcher const locale{lang};
+	vector<mapped_desktop_file> list;
+	vector<scanned_directory> scanned;
+	application_directory_stack pending;
+	// IDs already seen, a file shadowed by an earlier one is not parsed.
+	unordered_set<string> ids;
+	// A cached directory had a file whose shadowing changed.
+	bool shadowing_changed = false;
+
+	// Files to parse are read per directory as one batch, their slot in
+	// list is kept empty until then.
+	batch_reader reader;
+	vector<size_t> pending_index;
+	vector<string> pending_paths;
+	vector<string> contents;
+	auto parse_later = [&](string && path) {
+		pending_index.push_back(list.size());
+		pending_paths.push_back(path);
+		list.emplace_back(std::move(path), shared_ptr<mapped_desktop_file::mapping const>{});
+	};
+
+	auto parse_pending = [&]() {
+		reader.read(pending_paths, contents);
+		for (size_t i = 0; i < pending_index.size(); ++i)
+			list[pending_index[i]] = mapped_desktop_file{pending_paths[i], std::move(contents[i]), locale};
+		pending_index.clear();
+		pending_paths.clear();
+	};
+
+	auto add_file = [&](scanned_directory & d, string const & name, bool parse) {
+		bool shadowed = not ids.insert(d.dir.prefix+name).second;
+		if (shadowed) {
+			d.files.push_back(scanned_file{name, string::npos});
+			return;
+		}
+		d.files.push_back(scanned_file{name, list.size()});
+		if (parse)
+			parse_later(d.dir.path+"/"+name);
+	};
+
+	vector<string> files;
+	while(not pending.empty()) {
+		scanned_directory d;
+		d.dir = pending.pop();
+
+		// Get the mtime before reading, a concurrent update will be caught next time.
+		struct stat s;
+		stats_counters::add(counters.stat_calls);
+		if (stat(d.dir.path.c_str(), &s) != 0 or not S_ISDIR(s.st_mode))
+			continue;
+		d.mtime = s.st_mtim;
+
+		auto c = cached_directories.find(d.dir.path);
+		if (c != cached_directories.end() and c->second->mtime_sec == d.mtime.tv_sec
+				and c->second->mtime_nsec == d.mtime.tv_nsec) {
+			auto subdirs = cache.table<cache_string>(cache.header->subdirs);
+			for (uint32_t i = 0; i < c->second->n_subdirs; ++i)
+				d.subdirs.push_back(cache.str(subdirs[c->second->first_subdir+i]).to_string());
+			auto cached_files = cache.table<cache_file>(cache.header->files);
+			for (uint32_t i = 0; i < c->second->n_files; ++i) {
+				auto & f = cached_files[c->second->first_file+i];
+				bool was_shadowed = f.flags & CACHE_FILE_SHADOWED;
+				add_file(d, cache.str(f.name).to_string(), false);
+				bool shadowed = d.files.back().index == string::npos;
+				if (shadowed != was_shadowed)
+					shadowing_changed = true;
+				if (shadowed)
+					continue;
+				// No longer shadowed, it was never parsed.
+				if (was_shadowed)
+					parse_later(d.dir.path+"/"+d.files.back().name);
+				else
+					list.push_back(cache.load_file(d.dir.path, f));
+			}
+		} else {
+			files.clear();
+			read_application_directory(d.dir.path, files, d.subdirs);
+			for (auto & f: files)
+				add_file(d, f, true);
+			st->reparsed_directories += 1;
+		}
+		parse_pending();
+
+		pending.push_subdirs(d.dir, d.subdirs);
+		scanned.push_back(std::move(d));
+	}
+
+	st->directories = scanned.size();
+	st->files = list.size();
+
+	// Also rewrite when directories vanished.
+	if (st->reparsed_directories > 0 or shadowing_changed
+			or scanned.size() != cached_directories.size()) {
+		cache_writer writer;
+		for (auto & d: scanned)
+			writer.add_directory(d, list);
+
+		auto pos = cache_filename.rfind('/');
+		auto parent = cache_filename.substr(0, pos);
+		mkdir(parent.substr(0, parent.rfind('/')).c_str(), 0700);
+		mkdir(parent.c_str(), 0700);
+		st->written = writer.write(cache_filename, lang);
+	}
+
+	return list;
+}
+
+} // namespace xdg
@@ -0,0 +1,61 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SRC_XDG_APPLICATION_CACHE_HXX_
+#define SRC_XDG_APPLICATION_CACHE_HXX_
+
+#include <string>
+#include <vector>
+
+#include "xdg-mapped-desktop-file.hxx"
+
+namespace xdg {
+
+/**
+ * Persistent cache of parsed application desktop files, one file per
+ * locale stored in $XDG_CACHE_HOME/libxdg. The cache is loaded with a
+ * single mmap and keep the modification time of each scanned directory,
+ * only directories with a different mtime are read and parsed again.
+ **/
+struct application_cache {
+
+	struct stats {
+		size_t directories;          //< directories scanned.
+		size_t reparsed_directories; //< directories read and parsed again.
+		size_t files;                //< desktop files returned.
+		bool written;                //< the cache file was updated.
+	};
+
+	// Path of the cache file used for lang.
+	static std::string filename(std::string const & lang);
+
+	/**
+	 * Same result as mapped_desktop_file::list_all_applications, but
+	 * unchanged directories are served from the cache, the cache is
+	 * refreshed if anything changed.
+	 **/
+	static std::vector<mapped_desktop_file> list_all_applications(std::string const & lang, stats * st = nullptr);
+
+};
+
+} // namespace xdg
+
+#endif /* SRC_XDG_APPLICATION_CACHE_HXX_ */
@@ -0,0 +1,342 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "xdg-application-index.hxx"
+#include "xdg-application-scan.hxx"
+
+#include <algorithm>
+#include <cstring>
+
+namespace xdg {
+
+using namespace std;
+
+namespace {
+
+// Raw value of key in [Desktop Entry], empty if missing.
+string_view raw_value(desktop_file const & file, char const * key)
+{
+	auto g = file.find("Desktop Entry");
+	if (g == file.end())
+		return string_view{};
+	auto x = g->second.find(key);
+	if (x == g->second.end())
+		return string_view{};
+	return x->second.data;
+}
+
+string_view raw_value(mapped_desktop_file const & file, char const * key)
+{
+	auto g = file.find("Desktop Entry");
+	if (g == file.end())
+		return string_view{};
+	auto x = g->second.find(key);
+	if (x == g->second.end())
+		return string_view{};
+	return x->data;
+}
+
+// The program of an Exec value, without its directory nor its arguments.
+string exec_program(string const & exec)
+{
+	auto begin = exec.find_first_not_of(' ');
+	if (begin == string::npos)
+		return string{};
+	string program;
+	if (exec[begin] == '"') {
+		auto end = exec.find('"', begin+1);
+		program = exec.substr(begin+1, end == string::npos?string::npos:end-begin-1);
+	} else {
+		program = exec.substr(begin, exec.find(' ', begin)-begin);
+	}
+	auto slash = program.rfind('/');
+	if (slash != string::npos)
+		program.erase(0, slash+1);
+	return program;
+}
+
+uint32_t trigram(char const * s)
+{
+	auto p = reinterpret_cast<unsigned char const *>(s);
+	return (uint32_t{p[0]} << 16) | (uint32_t{p[1]} << 8) | p[2];
+}
+
+} // anonymous namespace
+
+application_index::application_index(vector<desktop_file> const & applications)
+{
+	_build(applications);
+}
+
+application_index::application_index(vector<mapped_desktop_file> const & applications)
+{
+	_build(applications);
+}
+
+template<typename T>
+void application_index::_build(vector<T> const & applications)
+{
+	auto roots = application_directories();
+	for (size_t i = 0; i < applications.size(); ++i) {
+		auto & file = applications[i];
+		if (file.find("Desktop Entry") == file.end())
+			continue;
+		if (group::convert<bool>(raw_value(file, "Hidden"))
+				or group::convert<bool>(raw_value(file, "NoDisplay")))
+			continue;
+
+		// The ID is the path relative to its application directory.
+		string id;
+		for (auto & r: roots) {
+			if (file.filename.size() > r.size() and file.filename[r.size()] == '/'
+					and file.filename.compare(0, r.size(), r) == 0) {
+				id = file.filename.substr(r.size()+1);
+				replace(id.begin(), id.end(), '/', '-');
+				break;
+			}
+		}
+		if (id.empty())
+			id = file.filename.substr(file.filename.rfind('/')+1);
+
+		_add_entry(id, i);
+		_add_field(FIELD_NAME, group::convert<string>(raw_value(file, "Name")));
+		_add_field(FIELD_GENERIC_NAME, group::convert<string>(raw_value(file, "GenericName")));
+		for (auto & k: group::convert<vector<string>>(raw_value(file, "Keywords")))
+			_add_field(FIELD_KEYWORD, k);
+		_add_field(FIELD_EXEC, exec_program(group::convert<string>(raw_value(file, "Exec"))));
+	}
+	_build_trigrams();
+}
+
+void application_index::_add_entry(string const & id, size_t application)
+{
+	_entries.push_back(entry{static_cast<uint32_t>(_text.size()), static_cast<uint32_t>(id.size()), 0,
+			static_cast<uint32_t>(_fields.size()), 0, application});
+	_text.append(id);
+	_text.push_back('\0');
+}
+
+void application_index::_add_field(uint8_t kind, string const & value)
+{
+	auto s = normalize(value);
+	if (s.empty())
+		return;
+	if (kind == FIELD_NAME)
+		_entries.back().name_size = s.size();
+	_entries.back().field_count += 1;
+	_fields.push_back(field{static_cast<uint32_t>(_text.size()), static_cast<uint32_t>(s.size()),
+			static_cast<uint32_t>(_entries.size()-1), kind});
+	_text.append(s);
+	_text.push_back('\0');
+}
+
+void application_index::_build_trigrams()
+{
+	vector<pair<uint32_t, uint32_t>> all;
+	string padded;
+	for (uint32_t f = 0; f < _fields.size(); ++f) {
+		auto & x = _fields[f];
+		padded.assign(1, ' ');
+		padded.append(_text, x.offset, x.size);
+		padded.push_back('\0');
+		for (size_t i = 0; i+3 <= padded.size(); ++i)
+			all.emplace_back(trigram(&padded[i]), f);
+	}
+	// Also drop trigrams repeated within a field.
+	sort(all.begin(), all.end());
+	all.erase(unique(all.begin(), all.end()), all.end());
+
+	_postings.reserve(all.size());
+	for (auto & x: all) {
+		if (_trigrams.empty() or _trigrams.back() != x.first) {
+			_trigrams.push_back(x.first);
+			_trigram_begin.push_back(_postings.size());
+		}
+		_postings.push_back(x.second);
+	}
+	_trigram_begin.push_back(_postings.size());
+}
+
+auto application_index::_score(field const & f, string const & word) const -> int
+{
+	static int const field_score[] = {40, 30, 20, 10};
+
+	char const * begin = &_text[f.offset];
+	char const * end = begin+f.size;
+	int best = 0;
+	for (auto x = begin; end-x >= static_cast<ptrdiff_t>(word.size()); ++x) {
+		x = static_cast<char const *>(memchr(x, word[0], end-x));
+		if (x == nullptr or end-x < static_cast<ptrdiff_t>(word.size()))
+			break;
+		if (memcmp(x, word.data(), word.size()) != 0)
+			continue;
+		if (x == begin and word.size() == f.size)
+			return 400+field_score[f.kind];
+		if (x == begin)
+			return 300+field_score[f.kind];
+		if (x[-1] == ' ')
+			best = 200;
+		else if (word.size() >= 3)
+			best = max(best, 100);
+	}
+	return best?best+field_score[f.kind]:0;
+}
+
+auto application_index::_postings_of(string const & word, size_t & begin, size_t & end) const -> bool
+{
+	auto range = [&](uint32_t first, uint32_t last) {
+		auto b = lower_bound(_trigrams.begin(), _trigrams.end(), first);
+		auto e = upper_bound(b, _trigrams.end(), last);
+		begin = _trigram_begin[b-_trigrams.begin()];
+		end = _trigram_begin[e-_trigrams.begin()];
+		return begin != end;
+	};
+
+	// Short words at word starts, all trigrams " w?" for a single character.
+	string key = " "+word;
+	if (word.size() == 1)
+		return range(trigram((key+'\0').c_str()), trigram((key+'\xff').c_str()));
+	if (word.size() == 2)
+		return range(trigram(key.c_str()), trigram(key.c_str()));
+
+	// Fields with the word have all its trigrams, return those of the rarest.
+	size_t rarest_begin = 0;
+	size_t rarest_end = _postings.size();
+	for (size_t i = 0; i+3 <= word.size(); ++i) {
+		if (not range(trigram(&word[i]), trigram(&word[i])))
+			return false;
+		if (end-begin < rarest_end-rarest_begin) {
+			rarest_begin = begin;
+			rarest_end = end;
+		}
+	}
+	begin = rarest_begin;
+	end = rarest_end;
+	return true;
+}
+
+auto application_index::search(string const & query, size_t max_results) const -> vector<match>
+{
+	vector<match> ret;
+	auto words = split(normalize(query), ' ');
+	if (words.empty() or words[0].empty())
+		return ret;
+
+	// Look up the rarest word first.
+	vector<pair<size_t, size_t>> postings;
+	for (auto & word: words) {
+		size_t begin, end;
+		if (not _postings_of(word, begin, end))
+			return ret;
+		postings.emplace_back(begin, end);
+	}
+	vector<size_t> order(words.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		order[i] = i;
+	sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return postings[a].second-postings[a].first < postings[b].second-postings[b].first;
+	});
+
+	vector<int> total(_entries.size(), 0);
+	vector<uint32_t> found;
+	auto & first = words[order[0]];
+	for (auto p = postings[order[0]].first; p < postings[order[0]].second; ++p) {
+		auto & f = _fields[_postings[p]];
+		int s = _score(f, first);
+		if (s > 0 and total[f.application] == 0)
+			found.push_back(f.application);
+		total[f.application] = max(total[f.application], s);
+	}
+
+	for (size_t w = 1; w < order.size(); ++w) {
+		auto & word = words[order[w]];
+		size_t kept = 0;
+		for (auto e: found) {
+			auto & x = _entries[e];
+			int best = 0;
+			for (auto f = x.first_field; f < x.first_field+x.field_count; ++f)
+				best = max(best, _score(_fields[f], word));
+			if (best > 0) {
+				total[e] += best;
+				found[kept++] = e;
+			}
+		}
+		found.resize(kept);
+	}
+
+	// Best score, then shortest name, then ID.
+	auto better = [&](uint32_t a, uint32_t b) {
+		if (total[a] != total[b])
+			return total[a] > total[b];
+		auto & ea = _entries[a];
+		auto & eb = _entries[b];
+		if (ea.name_size != eb.name_size)
+			return ea.name_size < eb.name_size;
+		return _text.compare(ea.id_offset, ea.id_size, _text, eb.id_offset, eb.id_size) < 0;
+	};
+	if (max_results != 0 and max_results < found.size()) {
+		partial_sort(found.begin(), found.begin()+max_results, found.end(), better);
+		found.resize(max_results);
+	} else {
+		sort(found.begin(), found.end(), better);
+	}
+
+	ret.reserve(found.size());
+	for (auto e: found) {
+		auto & x = _entries[e];
+		ret.push_back(match{string_view{&_text[x.id_offset], x.id_size}, x.application, total[e]});
+	}
+	return ret;
+}
+
+auto application_index::normalize(string_view const & s) -> string
+{
+	string ret;
+	ret.reserve(s.size());
+	bool space = true; //< drop leading and repeated separators.
+	for (size_t i = 0; i < s.size(); ++i) {
+		unsigned char c = s[i];
+		if (c == ' ' or c == '\t' or c == '\n' or c == '\r' or c == '-' or c == '_' or c == '.' or c == '/') {
+			if (not space)
+				ret.push_back(' ');
+			space = true;
+			continue;
+		}
+		space = false;
+		if (c >= 'A' and c <= 'Z') {
+			c += 'a'-'A';
+		} else if (c == 0xc3 and i+1 < s.size()) {
+			// Latin-1 uppercase letters in UTF-8, except the multiplication sign.
+			unsigned char d = s[++i];
+			if (d >= 0x80 and d <= 0x9e and d != 0x97)
+				d += 0x20;
+			ret.push_back(c);
+			c = d;
+		}
+		ret.push_back(c);
+	}
+	if (not ret.empty() and ret.back() == ' ')
+		ret.pop_back();
+	return ret;
+}
+
+} // namespace xdg
@@ -0,0 +1,127 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef SRC_XDG_APPLICATION_INDEX_HXX_
+#define SRC_XDG_APPLICATION_INDEX_HXX_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "xdg-utils.hxx"
+#include "xdg-desktop-file.hxx"
+#include "xdg-mapped-desktop-file.hxx"
+
+namespace xdg {
+
+/**
+ * Search index for application launchers, built once from the result of
+ * list_all_applications. Name, GenericName, each of the Keywords and the
+ * program of Exec are lowercased and normalized, i.e. '-', '_', '.' and
+ * '/' become spaces, then stored in one contiguous buffer with a trigram
+ * index over it. Hidden and NoDisplay applications are not indexed.
+ *
+ * A query is normalized the same way and split into words, an
+ * application match if each word is within one of its strings, words
+ * shorter than 3 characters only match at a word start. Matches are
+ * ranked by the field, Name first, and by where the word is found: the
+ * whole string, its start, a word start or elsewhere. Only the fields of
+ * the rarest word are looked up, the other words are checked against the
+ * remaining applications.
+ **/
+class application_index {
+
+	enum : uint8_t {
+		FIELD_NAME         = 0,
+		FIELD_GENERIC_NAME = 1,
+		FIELD_KEYWORD      = 2,
+		FIELD_EXEC         = 3
+	};
+
+	// One normalized string within _text.
+	struct field {
+		uint32_t offset;
+		uint32_t size;
+		uint32_t application;
+		uint8_t kind;
+	};
+
+	// One indexed application.
+	struct entry {
+		uint32_t id_offset; //< desktop file ID within _text.
+		uint32_t id_size;
+		uint32_t name_size; //< to rank shorter names first.
+		uint32_t first_field;
+		uint32_t field_count;
+		size_t application; //< index in the list given at construction.
+	};
+
+	std::string _text;
+	std::vector<field> _fields;
+	std::vector<entry> _entries;
+
+	/**
+	 * Trigram t is in the fields _postings[_trigram_begin[i]..._trigram_begin[i+1]]
+	 * where _trigrams[i] == t, _trigrams being sorted. Trigrams are taken
+	 * from ' '+field+'\0', thus the start of each word is indexed too.
+	 **/
+	std::vector<uint32_t> _trigrams;
+	std::vector<uint32_t> _trigram_begin;
+	std::vector<uint32_t> _postings;
+
+	void _add_field(uint8_t kind, std::string const & value);
+	void _add_entry(std::string const & filename, size_t application);
+	void _build_trigrams();
+	auto _score(field const & f, std::string const & word) const -> int;
+	auto _postings_of(std::string const & word, size_t & begin, size_t & end) const -> bool;
+
+	template<typename T>
+	void _build(std::vector<T> const & applications);
+
+public:
+
+	struct match {
+		string_view id;     //< desktop file ID, valid as long as the index.
+		size_t application; //< index in the list given at construction.
+		int score;          //< higher is better.
+	};
+
+	application_index(std::vector<desktop_file> const & applications);
+	application_index(std::vector<mapped_desktop_file> const & applications);
+
+	// Number of indexed applications.
+	auto size() const -> size_t { return _entries.size(); }
+
+	/**
+	 * Applications matching query, best first, at most max_results if not
+	 * 0. An empty query match nothing.
+	 **/
+	auto search(std::string const & query, size_t max_results = 0) const -> std::vector<match>;
+
+	// Lowercase and normalize s as done for indexed strings and queries.
+	static auto normalize(string_view const & s) -> std::string;
+
+};
+
+} // namespace xdg
+
+#endif /* SRC_XDG_APPLICATION_INDEX_HXX_ */
@@ -0,0 +1,291 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SRC_XDG_APPLICATION_SCAN_HXX_
+#define SRC_XDG_APPLICATION_SCAN_HXX_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_set>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "xdg-utils.hxx"
+#include "xdg-batch-read.hxx"
+#include "xdg-stats-counters.hxx"
+
+namespace xdg {
+
+/**
+ * Return $XDG_DATA_HOME/applications then each $XDG_DATA_DIRS/applications,
+ * the first has the highest precedence.
+ **/
+std::vector<std::string> application_directories();
+
+// Read one directory, files and subdirs are returned in readdir order.
+void read_application_directory(std::string const & path,
+		std::vector<std::string> & files, std::vector<std::string> & subdirs);
+
+/**
+ * A directory to scan. The desktop file ID of a file within it is prefix
+ * followed by the file name, i.e. its path relative to the application
+ * directory with '/' replaced by '-'.
+ **/
+struct application_directory {
+	std::string path;
+	std::string prefix;
+};
+
+/**
+ * Pending directories of a scan, popped in precedence order: application
+ * directories in order, each directory before its subdirs and subdirs in
+ * readdir order. The first file seen with a given ID shadows the others.
+ **/
+class application_directory_stack {
+	std::vector<application_directory> _pending;
+
+public:
+	application_directory_stack()
+	{
+		auto roots = application_directories();
+		for (auto r = roots.rbegin(); r != roots.rend(); ++r)
+			_pending.push_back(application_directory{*r, std::string{}});
+	}
+
+	bool empty() const { return _pending.empty(); }
+
+	application_directory pop()
+	{
+		auto ret = std::move(_pending.back());
+		_pending.pop_back();
+		return ret;
+	}
+
+	void push_subdirs(application_directory const & d, std::vector<std::string> const & subdirs)
+	{
+		for (auto s = subdirs.rbegin(); s != subdirs.rend(); ++s)
+			_pending.push_back(application_directory{d.path+"/"+*s, d.prefix+*s+"-"});
+	}
+
+};
+
+/**
+ * Parallel scan of application directories. Workers share a single queue
+ * of tasks, a task being either a directory to read or a chunk of files to
+ * parse. Shadowed files are found in precedence order as directories get
+ * read: once every directory of higher precedence is read, the files of a
+ * directory that are not shadowed are queued for parsing, while other
+ * directories are still being read. Each parsed file is stored in a slot
+ * allocated when its directory is read, thus parsing a file does not
+ * require any locking. The files of a chunk are read as one batch before
+ * being parsed. The result keep the same order as the sequential scan.
+ **/
+template<typename T>
+class application_scan {
+
+	struct node {
+		std::string path;
+		std::string prefix; //< desktop file ID prefix.
+		std::vector<std::string> files;
+		std::vector<std::unique_ptr<T>> parsed;
+		std::vector<bool> keep; //< not shadowed.
+		std::vector<std::unique_ptr<node>> children;
+		bool read; //< files and children are known.
+
+		node() : read{false} { }
+	};
+
+	struct task {
+		node * dir;
+		size_t begin;
+		size_t end;
+		bool is_directory;
+	};
+
+	static size_t const chunk_size = 16;
+
+	locale_matcher const locale;
+
+	std::mutex lock;
+	std::condition_variable cond;
+	std::deque<task> queue;
+	size_t pending; //< tasks queued or running.
+
+	node root;
+	// Precedence order walk of the read directories, with the next child
+	// to visit of each, and the desktop file IDs seen so far.
+	std::vector<std::pair<node *, size_t>> resolved;
+	std::unordered_set<std::string> ids;
+
+	void _read(node * n)
+	{
+		std::vector<std::string> subdirs;
+		read_application_directory(n->path, n->files, subdirs);
+		n->parsed.resize(n->files.size());
+		for (auto & d: subdirs) {
+			n->children.emplace_back(new node);
+			n->children.back()->path = n->path+"/"+d;
+			n->children.back()->prefix = n->prefix+d+"-";
+		}
+
+		std::unique_lock<std::mutex> l{lock};
+		for (auto & c: n->children) {
+			queue.push_front(task{c.get(), 0, 0, true});
+			++pending;
+		}
+		n->read = true;
+		_resolve();
+		if (not queue.empty())
+			cond.notify_all();
+	}
+
+	// Queue the files of n that are not shadowed, with lock held.
+	void _queue_files(node & n)
+	{
+		n.keep.resize(n.files.size());
+		for (size_t i = 0; i < n.files.size(); ++i)
+			n.keep[i] = ids.insert(n.prefix+n.files[i]).second;
+		for (size_t i = 0; i < n.files.size(); i += chunk_size) {
+			queue.push_back(task{&n, i, std::min(i+chunk_size, n.files.size()), false});
+			++pending;
+		}
+	}
+
+	/**
+	 * Queue the files of directories in precedence order, up to the first
+	 * directory not read yet. With lock held.
+	 **/
+	void _resolve()
+	{
+		while (not resolved.empty()) {
+			auto & top = resolved.back();
+			if (top.second == top.first->children.size()) {
+				resolved.pop_back();
+				continue;
+			}
+			node * c = top.first->children[top.second].get();
+			if (not c->read)
+				return;
+			top.second += 1;
+			_queue_files(*c);
+			resolved.emplace_back(c, 0);
+		}
+	}
+
+	void _parse(task const & t, batch_reader & reader)
+	{
+		std::vector<size_t> index;
+		std::vector<std::string> paths;
+		for (size_t i = t.begin; i < t.end; ++i) {
+			if (t.dir->keep[i]) {
+				index.push_back(i);
+				paths.push_back(t.dir->path+"/"+t.dir->files[i]);
+			}
+		}
+
+		std::vector<std::string> contents;
+		reader.read(paths, contents);
+		for (size_t k = 0; k < index.size(); ++k)
+			t.dir->parsed[index[k]].reset(new T(paths[k], std::move(contents[k]), locale));
+	}
+
+	void _worker()
+	{
+		// Threads do not inherit the account of the caller.
+		scoped_allocation_account account{application_stats().allocations};
+		// Created on the first chunk, workers may only read directories.
+		std::unique_ptr<batch_reader> reader;
+		std::unique_lock<std::mutex> l{lock};
+		for (;;) {
+			cond.wait(l, [this]() { return not queue.empty() or pending == 0; });
+			if (queue.empty())
+				return;
+			task t = queue.front();
+			queue.pop_front();
+			l.unlock();
+			if (t.is_directory) {
+				_read(t.dir);
+			} else {
+				if (not reader)
+					reader.reset(new batch_reader);
+				_parse(t, *reader);
+			}
+			l.lock();
+			if (--pending == 0)
+				cond.notify_all();
+		}
+	}
+
+	void _run_workers(unsigned nthreads)
+	{
+		std::vector<std::thread> threads;
+		for (unsigned i = 1; i < nthreads; ++i)
+			threads.emplace_back(&application_scan::_worker, this);
+		_worker();
+		for (auto & t: threads)
+			t.join();
+	}
+
+	// Same order as the sequential scan.
+	void _flatten(node & n, std::vector<T> & out)
+	{
+		for (auto & f: n.parsed) {
+			if (f)
+				out.push_back(std::move(*f));
+		}
+		for (auto & c: n.children)
+			_flatten(*c, out);
+	}
+
+public:
+
+	application_scan(locale_matcher const & locale) : locale(locale), pending{0} { }
+
+	std::vector<T> run(unsigned nthreads)
+	{
+		if (nthreads == 0)
+			nthreads = std::max(1u, std::thread::hardware_concurrency());
+
+		for (auto & d: application_directories()) {
+			root.children.emplace_back(new node);
+			root.children.back()->path = d;
+			queue.push_back(task{root.children.back().get(), 0, 0, true});
+			++pending;
+		}
+		root.read = true;
+		resolved.emplace_back(&root, 0);
+
+		_run_workers(nthreads);
+
+		std::vector<T> ret;
+		_flatten(root, ret);
+		return ret;
+	}
+
+};
+
+} // namespace xdg
+
+#endif /* SRC_XDG_APPLICATION_SCAN_HXX_ */
@@ -0,0 +1,230 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "xdg-application-set.hxx"
+#include "xdg-application-scan.hxx"
+#include "xdg-stats-counters.hxx"
+
+#include <cstring>
+#include <algorithm>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+namespace xdg {
+
+using namespace std;
+
+application_set::application_set(string const & lang) :
+	_locale{lang}
+{
+	reload();
+}
+
+auto application_set::reload() -> void
+{
+	_directories.clear();
+	_files.clear();
+	_ids.clear();
+	_applications.clear();
+	_roots = application_directories();
+	for (auto & d: _roots)
+		_add_directory(d);
+}
+
+auto application_set::_file_id(string const & path, size_t & root) const -> string
+{
+	for (root = 0; root < _roots.size(); ++root) {
+		auto & r = _roots[root];
+		if (path.size() > r.size()+1 and path[r.size()] == '/'
+				and path.compare(0, r.size(), r) == 0) {
+			string id = path.substr(r.size()+1);
+			replace(id.begin(), id.end(), '/', '-');
+			return id;
+		}
+	}
+	return string{};
+}
+
+// Parse the file with the highest precedence of id, if it changed.
+auto application_set::_elect(string const & id) -> bool
+{
+	auto x = _ids.find(id);
+	if (x == _ids.end())
+		return false;
+
+	string winner;
+	if (not x->second.empty())
+		winner = x->second.begin()->second;
+
+	// Drop the previous winner.
+	bool changed = false;
+	for (auto & c: x->second) {
+		if (c.second != winner)
+			changed |= _applications.erase(c.second) > 0;
+	}
+	if (x->second.empty())
+		_ids.erase(x);
+
+	if (not winner.empty() and not _applications.count(winner)) {
+		_applications.emplace(winner, desktop_file{winner, _locale});
+		changed = true;
+	}
+	return changed;
+}
+
+auto application_set::_add_file(string const & path) -> bool
+{
+	size_t root;
+	string id = _file_id(path, root);
+	if (id.empty())
+		return false;
+	_files[path] = id;
+	_ids[id].insert(make_pair(root, path));
+	return _elect(id);
+}
+
+auto application_set::_remove_file(string const & path) -> bool
+{
+	auto f = _files.find(path);
+	if (f == _files.end())
+		return false;
+	string id = f->second;
+	_files.erase(f);
+	bool changed = _applications.erase(path) > 0;
+	auto x = _ids.find(id);
+	if (x != _ids.end()) {
+		for (auto c = x->second.begin(); c != x->second.end(); ++c) {
+			if (c->second == path) {
+				x->second.erase(c);
+				break;
+			}
+		}
+	}
+	changed |= _elect(id);
+	return changed;
+}
+
+auto application_set::_add_directory(string const & path) -> bool
+{
+	struct stat st;
+	stats_counters::add(application_stats().stat_calls);
+	if (stat(path.c_str(), &st) != 0 or not S_ISDIR(st.st_mode))
+		return false;
+	_directories.insert(path);
+
+	vector<string> files;
+	vector<string> subdirs;
+	read_application_directory(path, files, subdirs);
+	for (auto & f: files)
+		_add_file(path+"/"+f);
+	for (auto & d: subdirs)
+		_add_directory(path+"/"+d);
+	return true;
+}
+
+auto application_set::_remove_directory(string const & path) -> bool
+{
+	bool changed = _directories.erase(path) > 0;
+	string prefix = path+"/";
+
+	auto d = _directories.lower_bound(prefix);
+	while (d != _directories.end() and d->compare(0, prefix.size(), prefix) == 0) {
+		d = _directories.erase(d);
+		changed = true;
+	}
+
+	vector<string> removed;
+	for (auto f = _files.lower_bound(prefix); f != _files.end()
+			and f->first.compare(0, prefix.size(), prefix) == 0; ++f)
+		removed.push_back(f->first);
+	for (auto & f: removed) {
+		_remove_file(f);
+		changed = true;
+	}
+
+	return changed;
+}
+
+auto application_set::_update_file(string const & path) -> bool
+{
+	stats_counters::add(application_stats().access_calls);
+	if (access(path.c_str(), R_OK) != 0)
+		return _remove_file(path);
+
+	if (not _files.count(path))
+		return _add_file(path);
+
+	// Modified, only the winner of its ID is parsed.
+	auto x = _applications.find(path);
+	if (x == _applications.end())
+		return false;
+	x->second = desktop_file{path, _locale};
+	return true;
+}
+
+auto application_set::update(vector<string> const & paths) -> bool
+{
+	bool changed = false;
+	for (auto & path: paths) {
+		bool inside = false;
+		for (auto & r: _roots) {
+			if (path.compare(0, r.size(), r) == 0
+					and (path.size() == r.size() or path[r.size()] == '/')) {
+				inside = true;
+				break;
+			}
+		}
+		if (not inside)
+			continue;
+
+		struct stat st;
+		stats_counters::add(application_stats().stat_calls);
+		if (stat(path.c_str(), &st) != 0) {
+			// removed, either a file or a whole directory.
+			changed |= _remove_file(path);
+			changed |= _remove_directory(path);
+		} else if (S_ISDIR(st.st_mode)) {
+			_remove_directory(path);
+			changed |= _add_directory(path);
+		} else if (path.size() > 8 and path.compare(path.size()-8, 8, ".desktop") == 0
+				and path[path.rfind('/')+1] != '.') {
+			changed |= _update_file(path);
+		}
+	}
+	return changed;
+}
+
+auto application_set::watched_directories() const -> vector<string>
+{
+	vector<string> ret{_directories.begin(), _directories.end()};
+	// Roots may not exist yet.
+	for (auto & r: _roots) {
+		if (not _directories.count(r))
+			ret.push_back(r);
+	}
+	return ret;
+}
+
+} // namespace xdg
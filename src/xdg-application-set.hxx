@@ -0,0 +1,86 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SRC_XDG_APPLICATION_SET_HXX_
+#define SRC_XDG_APPLICATION_SET_HXX_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+#include "xdg-desktop-file.hxx"
+
+namespace xdg {
+
+/**
+ * All applications of $XDG_DATA_HOME/applications and
+ * $XDG_DATA_DIRS/applications, kept in memory and updated file by file,
+ * usually from the events of a watcher. Only the file with the highest
+ * precedence of each desktop file ID is parsed and kept. An
+ * application_set is not thread safe.
+ **/
+class application_set {
+	// Desktop files of one ID ordered by precedence: root index then path.
+	using candidates = std::set<std::pair<size_t, std::string>>;
+
+	locale_matcher _locale;
+	std::vector<std::string> _roots;
+	std::set<std::string> _directories;
+	std::map<std::string, std::string> _files; //< path to ID of all desktop files.
+	std::map<std::string, candidates> _ids;
+	std::map<std::string, desktop_file> _applications;
+
+	auto _file_id(std::string const & path, size_t & root) const -> std::string;
+	auto _elect(std::string const & id) -> bool;
+	auto _add_file(std::string const & path) -> bool;
+	auto _remove_file(std::string const & path) -> bool;
+	auto _add_directory(std::string const & path) -> bool;
+	auto _remove_directory(std::string const & path) -> bool;
+	auto _update_file(std::string const & path) -> bool;
+
+public:
+	application_set(std::string const & lang);
+
+	// Applications by path of their desktop file, shadowed files excluded.
+	auto applications() const -> std::map<std::string, desktop_file> const &
+	{
+		return _applications;
+	}
+
+	/**
+	 * Apply the changes of files or directories in paths: only the
+	 * affected desktop files are parsed again. Return false if none of
+	 * the paths belong to the set.
+	 **/
+	auto update(std::vector<std::string> const & paths) -> bool;
+
+	// Scan everything again.
+	auto reload() -> void;
+
+	// Directories to watch to keep the set up to date.
+	auto watched_directories() const -> std::vector<std::string>;
+
+};
+
+} // namespace xdg
+
+#endif /* SRC_XDG_APPLICATION_SET_HXX_ */
@@ -0,0 +1,146 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "xdg-async.hxx"
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
+
+namespace xdg {
+
+using namespace std;
+
+namespace {
+
+class worker_pool {
+	mutex _lock;
+	condition_variable _ready;
+	deque<function<void()>> _tasks;
+	vector<thread> _threads;
+	bool _stop;
+
+	void _worker()
+	{
+		unique_lock<mutex> l{_lock};
+		for (;;) {
+			_ready.wait(l, [this]() { return _stop or not _tasks.empty(); });
+			if (_stop)
+				return;
+			auto task = std::move(_tasks.front());
+			_tasks.pop_front();
+			l.unlock();
+			task();
+			l.lock();
+		}
+	}
+
+public:
+	worker_pool() : _stop{false} { }
+
+	~worker_pool()
+	{
+		{
+			lock_guard<mutex> l{_lock};
+			_stop = true;
+		}
+		_ready.notify_all();
+		for (auto & t: _threads)
+			t.join();
+	}
+
+	void post(function<void()> task)
+	{
+		{
+			lock_guard<mutex> l{_lock};
+			if (_threads.empty()) {
+				unsigned n = max(2u, thread::hardware_concurrency());
+				for (unsigned i = 0; i < n; ++i)
+					_threads.emplace_back(&worker_pool::_worker, this);
+			}
+			_tasks.push_back(std::move(task));
+		}
+		_ready.notify_one();
+	}
+
+};
+
+} // anonymous namespace
+
+auto shared_executor() -> executor const &
+{
+	static worker_pool pool;
+	static executor const e = [](function<void()> task) {
+		pool.post(std::move(task));
+	};
+	return e;
+}
+
+auto load_theme_async(string const & identifier, cancellation const & c, executor const & e) -> future<shared_ptr<theme>>
+{
+	return run_async([identifier]() {
+		return make_shared<theme>(identifier);
+	}, c, e);
+}
+
+auto find_icon_async(shared_ptr<theme const> const & t, string const & name, int size, int scale,
+		cancellation const & c, executor const & e) -> future<string>
+{
+	return run_async([t, name, size, scale]() {
+		return t->find_icon(name, size, scale);
+	}, c, e);
+}
+
+auto find_icon_async(shared_ptr<theme const> const & t, string const & name, int size, int scale,
+		function<void(string const &)> const & done, cancellation const & c, executor const & e) -> void
+{
+	e([t, name, size, scale, done, c]() {
+		if (c.cancelled())
+			return;
+		string path;
+		try {
+			path = t->find_icon(name, size, scale);
+		} catch (...) {
+			return;
+		}
+		done(path);
+	});
+}
+
+auto find_icons_async(shared_ptr<theme const> const & t, vector<icon_request> const & requests,
+		cancellation const & c, executor const & e) -> future<vector<string>>
+{
+	return run_async([t, requests]() {
+		return t->find_icons(requests);
+	}, c, e);
+}
+
+auto list_all_applications_async(string const & lang, cancellation const & c, executor const & e) -> future<vector<mapped_desktop_file>>
+{
+	return run_async([lang]() {
+		return mapped_desktop_file::list_all_applications(lang);
+	}, c, e);
+}
+
+} // namespace xdg
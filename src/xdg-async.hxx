@@ -0,0 +1,128 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef SRC_XDG_ASYNC_HXX_
+#define SRC_XDG_ASYNC_HXX_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+
+#include "xdg-icon-theme.hxx"
+#include "xdg-mapped-desktop-file.hxx"
+
+namespace xdg {
+
+/**
+ * Run a task, on any thread, later or immediately. Tasks must not throw,
+ * async functions report errors through their future.
+ **/
+using executor = std::function<void(std::function<void()>)>;
+
+/**
+ * Pool of worker threads shared by the process, one per CPU and at least
+ * two, started on the first task. Queued tasks are dropped at exit.
+ **/
+auto shared_executor() -> executor const &;
+
+// Future of a request cancelled before it started.
+struct cancelled_error : public std::runtime_error {
+	cancelled_error() : std::runtime_error{"request cancelled"} { }
+};
+
+/**
+ * Shared cancel flag, copies refer to the same flag. A request checks it
+ * only when its task starts: a request already running completes.
+ **/
+class cancellation {
+	std::shared_ptr<std::atomic<bool>> _cancelled;
+
+public:
+	cancellation() : _cancelled{std::make_shared<std::atomic<bool>>(false)} { }
+
+	auto cancel() const -> void { _cancelled->store(true, std::memory_order_relaxed); }
+	auto cancelled() const -> bool { return _cancelled->load(std::memory_order_relaxed); }
+};
+
+/**
+ * Run f on e and return its result through a future, f is not run and
+ * the future throws cancelled_error if c is cancelled before it starts.
+ **/
+template<typename F>
+auto run_async(F && f, cancellation const & c = cancellation{}, executor const & e = shared_executor())
+	-> std::future<typename std::result_of<typename std::decay<F>::type()>::type>
+{
+	using result = typename std::result_of<typename std::decay<F>::type()>::type;
+	// std::function needs a copyable task.
+	auto promise = std::make_shared<std::promise<result>>();
+	auto ret = promise->get_future();
+	typename std::decay<F>::type task{std::forward<F>(f)};
+	e([promise, task, c]() {
+		if (c.cancelled()) {
+			promise->set_exception(std::make_exception_ptr(cancelled_error{}));
+			return;
+		}
+		try {
+			promise->set_value(task());
+		} catch (...) {
+			promise->set_exception(std::current_exception());
+		}
+	});
+	return ret;
+}
+
+// theme constructor off the calling thread, it reads index.theme files and icon directories.
+auto load_theme_async(std::string const & identifier, cancellation const & c = cancellation{},
+		executor const & e = shared_executor()) -> std::future<std::shared_ptr<theme>>;
+
+/**
+ * Same as theme::find_icon, the request keeps the theme alive. A cold
+ * lookup may read directories and index.theme files.
+ **/
+auto find_icon_async(std::shared_ptr<theme const> const & t, std::string const & name, int size, int scale,
+		cancellation const & c = cancellation{}, executor const & e = shared_executor()) -> std::future<std::string>;
+
+/**
+ * Same as above, done is called with the path from the thread running
+ * the lookup. It is not called if the request is cancelled or if the
+ * lookup throws.
+ **/
+auto find_icon_async(std::shared_ptr<theme const> const & t, std::string const & name, int size, int scale,
+		std::function<void(std::string const &)> const & done,
+		cancellation const & c = cancellation{}, executor const & e = shared_executor()) -> void;
+
+// Same as theme::find_icons.
+auto find_icons_async(std::shared_ptr<theme const> const & t, std::vector<icon_request> const & requests,
+		cancellation const & c = cancellation{}, executor const & e = shared_executor()) -> std::future<std::vector<std::string>>;
+
+// Same as mapped_desktop_file::list_all_applications.
+auto list_all_applications_async(std::string const & lang, cancellation const & c = cancellation{},
+		executor const & e = shared_executor()) -> std::future<std::vector<mapped_desktop_file>>;
+
+} // namespace xdg
+
+#endif /* SRC_XDG_ASYNC_HXX_ */
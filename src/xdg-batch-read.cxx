@@ -0,0 +1,307 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "xdg-batch-read.hxx"
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+}
+
+namespace xdg {
+
+using namespace std;
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+/**
+ * Minimal io_uring, without liburing: the queues are mmaped as described
+ * in io_uring_setup(2) and only used for batches of at most max_batch
+ * requests, all submitted then all reaped.
+ **/
+struct batch_reader::ring {
+	int fd;
+	void * sq_ring;
+	size_t sq_ring_size;
+	void * cq_ring;
+	size_t cq_ring_size;
+	io_uring_sqe * sqes;
+	size_t sqes_size;
+
+	unsigned * sq_tail;
+	unsigned * sq_mask;
+	unsigned * sq_array;
+	unsigned * cq_head;
+	unsigned * cq_tail;
+	unsigned * cq_mask;
+	io_uring_cqe * cqes;
+
+	unsigned queued; //< prepared but not yet submitted.
+
+	ring() : fd{-1}, sq_ring{MAP_FAILED}, cq_ring{MAP_FAILED}, sqes{nullptr}, queued{0} { }
+
+	~ring()
+	{
+		if (sqes)
+			munmap(sqes, sqes_size);
+		if (cq_ring != MAP_FAILED)
+			munmap(cq_ring, cq_ring_size);
+		if (sq_ring != MAP_FAILED)
+			munmap(sq_ring, sq_ring_size);
+		if (fd >= 0)
+			close(fd);
+	}
+
+	template<typename T>
+	static T * at(void * base, unsigned offset)
+	{
+		return reinterpret_cast<T *>(static_cast<char *>(base)+offset);
+	}
+
+	// Return nullptr if io_uring is not available, e.g. old kernel or seccomp.
+	static unique_ptr<ring> create(unsigned entries)
+	{
+		io_uring_params p;
+		memset(&p, 0, sizeof p);
+		unique_ptr<ring> r{new ring};
+		r->fd = syscall(__NR_io_uring_setup, entries, &p);
+		if (r->fd < 0)
+			return nullptr;
+		// OPENAT and READ came with the same kernel as this feature.
+		if (not (p.features & IORING_FEAT_RW_CUR_POS))
+			return nullptr;
+
+		r->sq_ring_size = p.sq_off.array+p.sq_entries*sizeof(unsigned);
+		r->cq_ring_size = p.cq_off.cqes+p.cq_entries*sizeof(io_uring_cqe);
+		r->sqes_size = p.sq_entries*sizeof(io_uring_sqe);
+
+		r->sq_ring = mmap(nullptr, r->sq_ring_size, PROT_READ|PROT_WRITE,
+				MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+		r->cq_ring = mmap(nullptr, r->cq_ring_size, PROT_READ|PROT_WRITE,
+				MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		void * sqes = mmap(nullptr, r->sqes_size, PROT_READ|PROT_WRITE,
+				MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+		if (r->sq_ring == MAP_FAILED or r->cq_ring == MAP_FAILED or sqes == MAP_FAILED)
+			return nullptr;
+		r->sqes = static_cast<io_uring_sqe *>(sqes);
+
+		r->sq_tail = at<unsigned>(r->sq_ring, p.sq_off.tail);
+		r->sq_mask = at<unsigned>(r->sq_ring, p.sq_off.ring_mask);
+		r->sq_array = at<unsigned>(r->sq_ring, p.sq_off.array);
+		r->cq_head = at<unsigned>(r->cq_ring, p.cq_off.head);
+		r->cq_tail = at<unsigned>(r->cq_ring, p.cq_off.tail);
+		r->cq_mask = at<unsigned>(r->cq_ring, p.cq_off.ring_mask);
+		r->cqes = at<io_uring_cqe>(r->cq_ring, p.cq_off.cqes);
+		return r;
+	}
+
+	io_uring_sqe * prepare(uint8_t opcode, int fd, uint64_t user_data)
+	{
+		unsigned index = (*sq_tail+queued) & *sq_mask;
+		queued += 1;
+		sq_array[index] = index;
+		auto sqe = &sqes[index];
+		memset(sqe, 0, sizeof *sqe);
+		sqe->opcode = opcode;
+		sqe->fd = fd;
+		sqe->user_data = user_data;
+		return sqe;
+	}
+
+	/**
+	 * Submit the prepared requests and call f(user_data, res) for each of
+	 * them once completed. Return false on io_uring_enter failure, which
+	 * only happen on invalid use.
+	 **/
+	template<typename F>
+	bool run(F && f)
+	{
+		unsigned n = queued;
+		queued = 0;
+		__atomic_store_n(sq_tail, *sq_tail+n, __ATOMIC_RELEASE);
+
+		unsigned to_submit = n;
+		unsigned completed = 0;
+		while (completed < n) {
+			int r = syscall(__NR_io_uring_enter, fd, to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+			if (r < 0) {
+				if (errno == EINTR or errno == EAGAIN or errno == EBUSY)
+					continue;
+				return false;
+			}
+			to_submit -= min<unsigned>(r, to_submit);
+
+			unsigned head = *cq_head;
+			unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+			for (; head != tail; ++head, ++completed) {
+				auto & cqe = cqes[head & *cq_mask];
+				f(cqe.user_data, cqe.res);
+			}
+			__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+		}
+		return true;
+	}
+
+};
+
+#else
+
+struct batch_reader::ring {
+	template<typename ... Args>
+	static unique_ptr<ring> create(Args ...) { return nullptr; }
+};
+
+#endif
+
+batch_reader::batch_reader(bool use_io_uring)
+{
+	if (use_io_uring and std::getenv("LIBXDG_NO_IO_URING") == nullptr)
+		_ring = ring::create(max_batch);
+}
+
+batch_reader::~batch_reader()
+{
+
+}
+
+void batch_reader::read(vector<string> const & paths, vector<string> & contents)
+{
+	contents.clear();
+	contents.resize(paths.size());
+	for (size_t begin = 0; begin < paths.size(); begin += max_batch) {
+		size_t end = min(begin+max_batch, paths.size());
+#ifdef HAVE_LINUX_IO_URING_H
+		if (_ring) {
+			_read_ring(paths, begin, end, contents);
+			continue;
+		}
+#endif
+		_read_ahead(paths, begin, end, contents);
+	}
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+void batch_reader::_read_ring(vector<string> const & paths, size_t begin, size_t end,
+		vector<string> & contents)
+{
+	vector<int> fds(end-begin, -1);
+
+	for (size_t i = begin; i < end; ++i) {
+		auto sqe = _ring->prepare(IORING_OP_OPENAT, AT_FDCWD, i-begin);
+		sqe->addr = reinterpret_cast<uintptr_t>(paths[i].c_str());
+		sqe->open_flags = O_RDONLY|O_CLOEXEC;
+	}
+	bool ok = _ring->run([&](uint64_t i, int res) {
+		fds[i] = res;
+	});
+
+	if (ok) {
+		for (size_t i = begin; i < end; ++i) {
+			struct stat st;
+			int fd = fds[i-begin];
+			if (fd < 0 or fstat(fd, &st) != 0 or st.st_size <= 0)
+				continue;
+			contents[i].resize(st.st_size);
+			auto sqe = _ring->prepare(IORING_OP_READ, fd, i-begin);
+			sqe->addr = reinterpret_cast<uintptr_t>(&contents[i][0]);
+			sqe->len = st.st_size;
+			sqe->off = 0;
+		}
+		vector<size_t> lengths(end-begin, 0);
+		ok = _ring->run([&](uint64_t i, int res) {
+			lengths[i] = res > 0 ? res : 0;
+		});
+
+		// Finish short reads synchronously, as _read_ahead does.
+		for (size_t i = begin; ok and i < end; ++i) {
+			auto & buffer = contents[i];
+			size_t length = lengths[i-begin];
+			while (length < buffer.size()) {
+				auto n = pread(fds[i-begin], &buffer[length], buffer.size()-length, length);
+				if (n < 0 and errno == EINTR)
+					continue;
+				if (n <= 0)
+					break;
+				length += n;
+			}
+			buffer.resize(length);
+		}
+	}
+
+	for (auto fd: fds) {
+		if (fd >= 0)
+			close(fd);
+	}
+
+	if (not ok) {
+		_ring.reset();
+		_read_ahead(paths, begin, end, contents);
+	}
+}
+#endif
+
+void batch_reader::_read_ahead(vector<string> const & paths, size_t begin, size_t end,
+		vector<string> & contents)
+{
+	vector<int> fds(end-begin, -1);
+	for (size_t i = begin; i < end; ++i) {
+		int fd = open(paths[i].c_str(), O_RDONLY|O_CLOEXEC);
+		fds[i-begin] = fd;
+		if (fd >= 0)
+			posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	}
+
+	for (size_t i = begin; i < end; ++i) {
+		int fd = fds[i-begin];
+		if (fd < 0)
+			continue;
+		struct stat st;
+		if (fstat(fd, &st) == 0 and st.st_size > 0) {
+			auto & buffer = contents[i];
+			buffer.resize(st.st_size);
+			size_t length = 0;
+			while (length < buffer.size()) {
+				auto n = ::read(fd, &buffer[length], buffer.size()-length);
+				if (n < 0 and errno == EINTR)
+					continue;
+				if (n <= 0)
+					break;
+				length += n;
+			}
+			buffer.resize(length);
+		}
+		close(fd);
+	}
+}
+
+} // namespace xdg
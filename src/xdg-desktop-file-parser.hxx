@@ -0,0 +1,120 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SRC_XDG_DESKTOP_FILE_PARSER_HXX_
+#define SRC_XDG_DESKTOP_FILE_PARSER_HXX_
+
+#include "xdg-utils.hxx"
+
+#include <cstring>
+#include <cctype>
+#include <cstdint>
+
+namespace xdg {
+
+/**
+ * Single pass desktop file scanner, it does not allocate and only produce
+ * slices of the input buffer. The handler must provide:
+ *
+ *   void group(string_view name);
+ *   void entry(string_view key, string_view locale, bool localized, string_view value);
+ *   void invalid(string_view line);
+ *
+ **/
+template<typename H>
+void parse_desktop_file(char const * cur, char const * end, H & handler)
+{
+	while (cur < end) {
+		auto eol = static_cast<char const *>(std::memchr(cur, '\n', end-cur));
+		if (eol == nullptr)
+			eol = end;
+
+		auto line_begin = cur;
+		cur = eol+1;
+
+		// Empty line or comment
+		if (line_begin == eol or *line_begin == '#')
+			continue;
+
+		if (*line_begin == '[') {
+			bool valid = (eol-line_begin) > 2 and eol[-1] == ']';
+			for (auto x = line_begin+1; valid and x < eol-1; ++x) {
+				if (std::iscntrl(static_cast<unsigned char>(*x)))
+					valid = false;
+			}
+			if (valid) {
+				handler.group(string_view{line_begin+1, eol-1});
+			} else {
+				handler.invalid(string_view{line_begin, eol});
+			}
+			continue;
+		}
+
+		auto x = line_begin;
+		while (x < eol and (std::isalnum(static_cast<unsigned char>(*x)) or *x == '-'))
+			++x;
+
+		if (x == line_begin) {
+			// Line with only white spaces are ignored
+			while (x < eol and std::isspace(static_cast<unsigned char>(*x)))
+				++x;
+			if (x != eol)
+				handler.invalid(string_view{line_begin, eol});
+			continue;
+		}
+
+		string_view key{line_begin, x};
+		string_view locale;
+		bool localized = false;
+
+		if (x < eol and *x == '[') {
+			auto locale_begin = ++x;
+			while (x < eol and (std::isalnum(static_cast<unsigned char>(*x))
+					or *x == '_' or *x == '-' or *x == '.' or *x == '@'))
+				++x;
+			if (x == eol or *x != ']' or x == locale_begin) {
+				handler.invalid(string_view{line_begin, eol});
+				continue;
+			}
+			locale = string_view{locale_begin, x};
+			localized = true;
+			++x;
+		}
+
+		while (x < eol and (*x == ' ' or *x == '\t'))
+			++x;
+
+		if (x == eol or *x != '=') {
+			handler.invalid(string_view{line_begin, eol});
+			continue;
+		}
+		++x;
+
+		while (x < eol and (*x == ' ' or *x == '\t'))
+			++x;
+
+		handler.entry(key, locale, localized, string_view{x, eol});
+	}
+}
+
+} // namespace xdg
+
+#endif /* SRC_XDG_DESKTOP_FILE_PARSER_HXX_ */
@@ -21,13 +21,21 @@ along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "xdg-utils.hxx"
 
-#include <regex>
 #include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <unordered_set>
 #include "xdg-desktop-file.hxx"
+#include "xdg-desktop-file-parser.hxx"
+#include "xdg-application-scan.hxx"
+#include "xdg-batch-read.hxx"
+#include "xdg-stats-counters.hxx"
 
 extern "C" {
 #include <sys/types.h>
 #include <dirent.h>
+#include <stdlib.h>
+#include <locale.h>
 }
 
 namespace xdg {
@@ -45,162 +53,398 @@ ostream & operator<<(ostream & out, desktop_file const & data)
        return out;
 }
 
-desktop_file::desktop_file(string const & filename, string const & lang) :
-	filename{filename}
+namespace {
+
+/**
+ * Append the value of the escape sequence starting at x, \s, \n, \t, \r
+ * and \\ as defined by the desktop entry spec, plus list_separator if
+ * not NUL. Return the position of the last character of the sequence.
+ **/
+char const * unescape_sequence(char const * x, char const * end, char list_separator, string & out)
 {
-	ifstream fin(filename);
+	if (x+1 == end) {
+		out.push_back(*x);
+		return x;
+	}
+	switch (*++x) {
+	case 's':  out.push_back(' ');  break;
+	case 'n':  out.push_back('\n'); break;
+	case 't':  out.push_back('\t'); break;
+	case 'r':  out.push_back('\r'); break;
+	case '\\': out.push_back('\\'); break;
+	default:
+		if (list_separator != '\0' and *x == list_separator) {
+			out.push_back(*x);
+		} else {
+			// Unknown escape are kept as is.
+			out.push_back('\\');
+			out.push_back(*x);
+		}
+	}
+	return x;
+}
+
+} // anonymous namespace
+
+template<>
+double group::convert<double>(string_view const & s)
+{
+	auto x = s.begin();
+	while (x != s.end() and (*x == ' ' or *x == '\t'))
+		++x;
+	auto begin = x;
+
+	// Find the end of the decimal number, strtod also accepts hexadecimal,
+	// inf and nan that istringstream did not.
+	auto is_digit = [&](char const * p) { return p != s.end() and *p >= '0' and *p <= '9'; };
+	if (x != s.end() and (*x == '-' or *x == '+'))
+		++x;
+	while (is_digit(x))
+		++x;
+	if (x != s.end() and *x == '.') {
+		++x;
+		while (is_digit(x))
+			++x;
+	}
+	if (x != s.end() and (*x == 'e' or *x == 'E')) {
+		auto e = x+1;
+		if (e != s.end() and (*e == '-' or *e == '+'))
+			++e;
+		if (is_digit(e)) {
+			while (is_digit(e))
+				++e;
+			x = e;
+		}
+	}
 
-	static regex const comment("^(#[^\\n]*\\n?)|(\\s+)$");
-	static regex const group("^\\[([^[:cntrl:]]+)\\]\\n?$");
-	static regex const entry("^([a-zA-Z0-9-]+)(\\[([a-zA-Z]+)(_[a-zA-Z-]+)?(\\.[a-zA-Z-]+)?(@[a-zA-Z]+)?\\])?\\s?=\\s?([^\\n]*)\\n?$");
-	static regex const locale("^([a-zA-Z]+)(_[a-zA-Z]+)?(\\.[a-zA-Z]+)?(@[a-zA-Z]+)?$");
+	// strtod needs a NUL terminated string, usual numbers fit in buffer.
+	size_t length = x-begin;
+	char buffer[64];
+	string large;
+	char const * number = buffer;
+	if (length < sizeof buffer) {
+		memcpy(buffer, begin, length);
+		buffer[length] = '\0';
+	} else {
+		large.assign(begin, x);
+		number = large.c_str();
+	}
+
+	// Correctly rounded, and '.' whatever the locale of the process.
+	static locale_t const c_locale = newlocale(LC_ALL_MASK, "C", nullptr);
+	return strtod_l(number, nullptr, c_locale);
+}
+
+template<>
+string group::convert<string>(string_view const & s)
+{
+	string ret;
+	ret.reserve(s.size());
+	for (auto x = s.begin(); x != s.end(); ++x) {
+		if (*x == '\\')
+			x = unescape_sequence(x, s.end(), '\0', ret);
+		else
+			ret.push_back(*x);
+	}
+	return ret;
+}
+
+template<>
+vector<string> group::convert<vector<string>>(string_view const & s)
+{
+	vector<string> ret;
+	string element;
+	for (auto x = s.begin(); x != s.end(); ++x) {
+		if (*x == '\\') {
+			x = unescape_sequence(x, s.end(), ';', element);
+		} else if (*x == ';') {
+			ret.push_back(std::move(element));
+			element.clear();
+		} else {
+			element.push_back(*x);
+		}
+	}
+	// The last ';' is optional.
+	if (not element.empty())
+		ret.push_back(std::move(element));
+	return ret;
+}
 
-	string language  = "";
-	string territory = "";
-	string codeset   = "";
-	string modifier  = "";
+namespace {
 
+struct desktop_file_builder {
+	desktop_file & file;
+	locale_matcher const & lang;
+	vector<string> const * keys; //< keys filter, nullptr to keep everything.
+	xdg::group * cur_group;
+	string key_buffer; //< reused for each key lookup.
+	uint64_t invalid_lines;
+
+	desktop_file_builder(desktop_file & file, locale_matcher const & lang, vector<string> const * keys) :
+		file(file), lang(lang), keys{keys}, cur_group{nullptr}, invalid_lines{0} { }
+
+	bool is_kept(string_view const & key) const
+	{
+		if (keys->empty())
+			return true;
+		for (auto & k: *keys) {
+			if (key == string_view{k})
+				return true;
+		}
+		return false;
+	}
+
+	void group(string_view const & name)
 	{
-		smatch m;
-		if (regex_match(lang, m, locale)) {
-			language    = m[1];
-			territory   = m[2];
-			codeset     = m[3];
-			modifier    = m[4];
+		// With a filter, entries of other groups are ignored.
+		if (keys and name != string_view{"Desktop Entry"}) {
+			cur_group = nullptr;
+			return;
 		}
+		key_buffer.assign(name.data(), name.size());
+		cur_group = &file[key_buffer];
 	}
 
-	xdg::group * cur_group = nullptr;
-	vector<char> buffer;
-	while(not fin.eof()) {
-		buffer.push_back(fin.get());
-		if (buffer.back() == '\n') {
-			// TODO:processe line
-
-			string s{buffer.begin(), buffer.end()};
-			smatch m;
-
-			if (regex_match(s, comment)) {
-//				cout << "COMMENT:" << s;
-			} else
-
-			if (regex_match(s, m, group)) {
-//				cout << "GROUP:" << m[1] << endl;
-				cur_group = &this->operator [](m[1]);
-			} else
-
-
-			if (regex_match(s, m, entry)) {
-//				cout << "ENTRY:" << s;
-
-				if (cur_group == nullptr) {
-					// TODO: Error invalid file.
-					buffer.clear();
-					continue;
-				}
-
-				string key = m[1];
-				entry_data tmp;
-				string tmp_language  = m[3];
-				string tmp_territory = m[4];
-				string tmp_codeset   = m[5];
-				string tmp_modifier  = m[6];
-
-				tmp.data = m[7];
-
-				// If no language is defined, score 0 but mach any LANG.
-				if (m[2] == "") {
-					tmp.score = 0;
-				} else {
-					tmp.score = 0;
-					if (language != "") {
-						if (language == tmp_language) {
-							tmp.score += 8;
-						} else {
-							tmp.score -= 16;
-						}
-					}
-
-					if (territory != "") {
-						if (territory == tmp_territory) {
-							tmp.score += 4;
-						} else {
-							tmp.score -= 16;
-						}
-					}
-
-					if (modifier != "") {
-						if (modifier == tmp_modifier) {
-							tmp.score += 2;
-						} else {
-							tmp.score -= 16;
-						}
-					}
-				}
-
-				if (tmp.score >= 0) {
-					auto f = cur_group->find(key);
-					if (f == cur_group->end()) {
-						(*cur_group)[key] = tmp;
-					} else if (f->second.score < tmp.score) {
-						f->second = tmp;
-					}
-				}
-
-			} else {
-				cout << "INVALID:" << s;
-			}
-			buffer.clear();
+	void entry(string_view const & key, string_view const & locale, bool localized, string_view const & value)
+	{
+		if (cur_group == nullptr) {
+			// TODO: Error invalid file.
+			return;
+		}
+
+		if (keys and not is_kept(key))
+			return;
+
+		// If no language is defined, score 0 but mach any LANG.
+		int32_t score = 0;
+		if (localized)
+			score = lang.score(locale);
+
+		// Discarded translations are never copied.
+		if (score < 0)
+			return;
+
+		key_buffer.assign(key.data(), key.size());
+		auto f = cur_group->find(key_buffer);
+		if (f == cur_group->end()) {
+			auto & e = (*cur_group)[key_buffer];
+			e.score = score;
+			e.data.assign(value.data(), value.size());
+		} else if (f->second.score < score) {
+			f->second.score = score;
+			f->second.data.assign(value.data(), value.size());
 		}
 	}
 
+	void invalid(string_view const &)
+	{
+		invalid_lines += 1;
+	}
+
+};
+
+} // anonymous namespace
+
+desktop_file::desktop_file()
+{
+
 }
 
+desktop_file::desktop_file(string const & filename, string const & lang) :
+	desktop_file{filename, locale_matcher{lang}}
+{
+
+}
 
-vector<desktop_file> desktop_file::list_all_applications(string const & lang)
+desktop_file::desktop_file(string const & filename, locale_matcher const & locale) :
+	filename{filename}
 {
-	static regex const desktop_file_patern{"^.+\\.desktop$"};
+	_load(locale, nullptr);
+}
 
-	vector<desktop_file> list;
-	stack<string> pending_directories;
+desktop_file::desktop_file(string const & filename, locale_matcher const & locale, vector<string> const & keys) :
+	filename{filename}
+{
+	_load(locale, &keys);
+}
 
-	char const * XDG_DATA_DIRS = std::getenv("XDG_DATA_DIRS");
+desktop_file::desktop_file(string const & filename, string const & contents, locale_matcher const & locale) :
+	filename{filename}
+{
+	_parse(contents, locale, nullptr);
+}
 
-	if (XDG_DATA_DIRS) {
-		for (auto & p: split(XDG_DATA_DIRS, ':')) {
-			pending_directories.push(p+"/applications");
-		}
+desktop_file::desktop_file(string const & filename, string const & contents, locale_matcher const & locale,
+		vector<string> const & keys) :
+	filename{filename}
+{
+	_parse(contents, locale, &keys);
+}
+
+void desktop_file::_load(locale_matcher const & locale, vector<string> const * keys)
+{
+	ifstream fin(filename, ios::in | ios::binary);
+
+	// Read the whole file at once.
+	string buffer;
+	fin.seekg(0, ios::end);
+	auto length = fin.tellg();
+	if (length > 0) {
+		buffer.resize(length);
+		fin.seekg(0, ios::beg);
+		fin.read(&buffer[0], length);
+		buffer.resize(fin.gcount());
 	}
 
-	while(not pending_directories.empty()) {
-		string const & curdir = pending_directories.top();
+	_parse(buffer, locale, keys);
+}
+
+void desktop_file::_parse(string const & contents, locale_matcher const & locale, vector<string> const * keys)
+{
+	auto & stats = application_stats();
+	scoped_timer timer{stats.parse};
+
+	desktop_file_builder builder{*this, locale, keys};
+	parse_desktop_file(contents.data(), contents.data()+contents.size(), builder);
+
+	stats_counters::add(stats.files_parsed);
+	stats_counters::add(stats.bytes_read, contents.size());
+	stats_counters::add(stats.invalid_entries, builder.invalid_lines);
+}
+
+
+vector<string> application_directories()
+{
+	vector<string> ret;
+	// Relative paths are invalid and ignored, as defined by the spec.
+	auto add = [&ret](string const & dir) {
+		if (dir.empty() or dir[0] != '/')
+			return;
+		string path = dir+"/applications";
+		if (find(ret.begin(), ret.end(), path) == ret.end())
+			ret.push_back(path);
+	};
+
+	char const * XDG_DATA_HOME = std::getenv("XDG_DATA_HOME");
+	char const * HOME = std::getenv("HOME");
+	if (XDG_DATA_HOME and XDG_DATA_HOME[0] != '\0')
+		add(XDG_DATA_HOME);
+	else if (HOME)
+		add(string{HOME}+"/.local/share");
+
+	char const * XDG_DATA_DIRS = std::getenv("XDG_DATA_DIRS");
+	if (XDG_DATA_DIRS == nullptr or XDG_DATA_DIRS[0] == '\0')
+		XDG_DATA_DIRS = "/usr/local/share:/usr/share";
+	for (auto & p: split(XDG_DATA_DIRS, ':'))
+		add(p);
+	return ret;
+}
 
-		DIR * dir = opendir(curdir.c_str());
-		if (dir == nullptr) {
-			pending_directories.pop();
+void read_application_directory(string const & path, vector<string> & files, vector<string> & subdirs)
+{
+	stats_counters::add(application_stats().directories_read);
+	DIR * dir = opendir(path.c_str());
+	if (dir == nullptr)
+		return;
+
+	struct dirent * p;
+	while((p = readdir(dir)) != nullptr) {
+		// skip hidden file and "." and "..", and avoid infinite loop
+		// we guess that a filename cannot be empty
+		if (p->d_name[0] == '.')
 			continue;
+		if (p->d_type == DT_DIR or p->d_type == DT_UNKNOWN)
+			subdirs.push_back(p->d_name);
+		if (p->d_type == DT_REG or p->d_type == DT_UNKNOWN) {
+			auto len = strlen(p->d_name);
+			if (len > 8 and strcmp(p->d_name+len-8, ".desktop") == 0)
+				files.push_back(p->d_name);
 		}
+	}
+	closedir(dir);
+}
+
+namespace {
+
+// Call f with the path of each application file not shadowed, in precedence order.
+template<typename F>
+void for_each_application_file(F && f)
+{
+	application_directory_stack pending;
+	unordered_set<string> ids;
+
+	vector<string> files;
+	vector<string> subdirs;
+	while(not pending.empty()) {
+		auto const d = pending.pop();
+
+		files.clear();
+		subdirs.clear();
+		read_application_directory(d.path, files, subdirs);
 
-		struct dirent * p;
-		while((p = readdir(dir)) != nullptr) {
-			// skip hidden file and "." and "..", and avoid infinite loop
-			// we guess that a filename cannot be empty
-			if (p->d_name[0] == '.')
-				continue;
-			if (p->d_type == DT_DIR or p->d_type == DT_UNKNOWN)
-				pending_directories.push(curdir+"/"+p->d_name);
-			if (p->d_type == DT_REG or p->d_type == DT_UNKNOWN) {
-				if (regex_match(p->d_name, desktop_file_patern)) {
-					cout << p->d_name << endl;
-					list.emplace_back(desktop_file(curdir+"/"+p->d_name, lang));
-				}
-			}
+		for (auto & file: files) {
+			if (ids.insert(d.prefix+file).second)
+				f(d.path+"/"+file);
 		}
-		closedir(dir);
-		pending_directories.pop();
+		pending.push_subdirs(d, subdirs);
 	}
+}
+
+} // anonymous namespace
+
+vector<string> desktop_file::list_all_application_files()
+{
+	vector<string> list;
+	for_each_application_file([&](string && path) {
+		list.push_back(std::move(path));
+	});
+	return list;
+}
 
+vector<desktop_file> desktop_file::list_all_applications(string const & lang)
+{
+	scoped_timer timer{application_stats().scan};
+	scoped_allocation_account account{application_stats().allocations};
+	vector<desktop_file> list;
+	auto files = list_all_application_files();
+	list.reserve(files.size());
+	locale_matcher const locale{lang};
+	batch_reader{}.for_each(files, [&](string const & path, string && contents) {
+		list.emplace_back(path, contents, locale);
+	});
 	return list;
 }
 
+vector<desktop_file> desktop_file::list_all_applications(string const & lang, unsigned nthreads)
+{
+	if (nthreads == 1)
+		return list_all_applications(lang);
+	scoped_timer timer{application_stats().scan};
+	scoped_allocation_account account{application_stats().allocations};
+	return application_scan<desktop_file>{locale_matcher{lang}}.run(nthreads);
+}
+
+void desktop_file::for_each_application(string const & lang, vector<string> const & keys,
+		function<void(desktop_file const &)> const & f)
+{
+	scoped_timer timer{application_stats().scan};
+	scoped_allocation_account account{application_stats().allocations};
+	locale_matcher const locale{lang};
+	batch_reader reader;
+	// Only one batch of paths and files is kept.
+	vector<string> paths;
+	auto flush = [&]() {
+		reader.for_each(paths, [&](string const & path, string && contents) {
+			f(desktop_file{path, contents, locale, keys});
+		});
+		paths.clear();
+	};
+	for_each_application_file([&](string && path) {
+		paths.push_back(std::move(path));
+		if (paths.size() == batch_reader::max_batch)
+			flush();
+	});
+	flush();
+}
+
 } // namespace xdg
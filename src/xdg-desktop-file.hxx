@@ -28,6 +28,12 @@ along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
 #include <iostream>
 #include <cstdint>
 #include <vector>
+#include <functional>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include "xdg-utils.hxx"
 
 namespace xdg {
 
@@ -38,20 +44,29 @@ struct entry_data {
 
 struct group : public std::unordered_map<std::string, entry_data>
 {
+	/**
+	 * Convert a raw value, as written in the file. int and double are
+	 * parsed without the locale of the process, leading blanks are skipped,
+	 * trailing garbage is ignored and an invalid number is 0. A bool is
+	 * true for "true" or "1". A std::string is unescaped and a
+	 * std::vector<std::string> is a ';' separated list, "\;" being a ';'
+	 * within an element. Other types are read with an istringstream.
+	 **/
 	template<typename T>
-	static T convert(std::string const & s);
+	static T convert(string_view const & s)
+	{
+		T ret{};
+		std::istringstream(s.to_string()) >> ret;
+		return ret;
+	}
 
 	template<typename T>
 	T getattr(std::string const & key) const
 	{
 		auto x = this->find(key);
-		if (x == this->end()) {
+		if (x == this->end())
 			throw std::runtime_error("Key not available");
-		} else {
-			T ret;
-			std::istringstream(x->second.data) >> ret;
-			return ret;
-		}
+		return convert<T>(x->second.data);
 	}
 
 
@@ -59,26 +74,98 @@ struct group : public std::unordered_map<std::string, entry_data>
 	T getattr(std::string const & key, T const & default_value) const
 	{
 		auto x = this->find(key);
-		if (x == this->end()) {
+		if (x == this->end())
 			return default_value;
-		} else {
-			T ret;
-			std::istringstream(x->second.data) >> ret;
-			return ret;
-		}
+		return convert<T>(x->second.data);
 	}
 };
 
+template<>
+inline int group::convert<int>(string_view const & s)
+{
+	auto x = s.begin();
+	while (x != s.end() and (*x == ' ' or *x == '\t'))
+		++x;
+	bool negative = x != s.end() and *x == '-';
+	if (x != s.end() and (*x == '-' or *x == '+'))
+		++x;
+	// Out of range values are clamped, as istringstream did.
+	int64_t const limit = negative?-int64_t{std::numeric_limits<int>::min()}:std::numeric_limits<int>::max();
+	int64_t ret = 0;
+	for (; x != s.end() and *x >= '0' and *x <= '9'; ++x)
+		ret = std::min<int64_t>(ret*10+(*x-'0'), limit);
+	return static_cast<int>(negative?-ret:ret);
+}
+
+template<>
+inline bool group::convert<bool>(string_view const & s)
+{
+	return s == string_view{"true"} or s == string_view{"1"};
+}
+
+template<>
+double group::convert<double>(string_view const & s);
+
+template<>
+std::string group::convert<std::string>(string_view const & s);
+
+template<>
+std::vector<std::string> group::convert<std::vector<std::string>>(string_view const & s);
+
 struct desktop_file : public std::unordered_map<std::string, group>
 {
 	std::string filename;
 
+private:
+	void _load(locale_matcher const & locale, std::vector<std::string> const * keys);
+	void _parse(std::string const & contents, locale_matcher const & locale, std::vector<std::string> const * keys);
+
+public:
+
 	friend std::ostream & operator<<(std::ostream & out, desktop_file const & file);
 
+	// Empty file, groups are filled by the caller.
+	desktop_file();
+
 	desktop_file(std::string const & filename, std::string const & lang);
 
+	// Same as above, with a matcher built once for many files.
+	desktop_file(std::string const & filename, locale_matcher const & locale);
+
+	/**
+	 * Same as above, but only the [Desktop Entry] group is kept and only
+	 * its keys listed in keys, all its keys if keys is empty. Other groups
+	 * and keys are skipped by the parser without any copy.
+	 **/
+	desktop_file(std::string const & filename, locale_matcher const & locale, std::vector<std::string> const & keys);
+
+	// Same as the two above, parse contents already read from filename.
+	desktop_file(std::string const & filename, std::string const & contents, locale_matcher const & locale);
+	desktop_file(std::string const & filename, std::string const & contents, locale_matcher const & locale,
+			std::vector<std::string> const & keys);
+
+	/**
+	 * List the path of all .desktop files within $XDG_DATA_HOME/applications
+	 * and $XDG_DATA_DIRS/applications in precedence order. A file shadowed by
+	 * an earlier one with the same desktop file ID is skipped.
+	 **/
+	static std::vector<std::string> list_all_application_files();
+
+	// Parse the files of list_all_application_files, shadowed files are never read.
 	static std::vector<desktop_file> list_all_applications(std::string const & lang);
 
+	// Same as above but directories are read and files are parsed by nthreads
+	// threads, 0 means one per CPU. The result keep the sequential order.
+	static std::vector<desktop_file> list_all_applications(std::string const & lang, unsigned nthreads);
+
+	/**
+	 * Call f for each application, in the order of list_all_applications,
+	 * each file being parsed with the keys filter above. Only one file is
+	 * alive at a time, f must copy what it need to keep.
+	 **/
+	static void for_each_application(std::string const & lang, std::vector<std::string> const & keys,
+			std::function<void(desktop_file const &)> const & f);
+
 };
 
 } // namespace xdg
@@ -0,0 +1,110 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "xdg-icon-cache.hxx"
+
+#include <cstring>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+namespace xdg {
+
+using namespace std;
+
+icon_cache::~icon_cache()
+{
+	if (_data)
+		munmap(const_cast<char *>(_data), _size);
+}
+
+unique_ptr<icon_cache> icon_cache::open(string const & theme_directory)
+{
+	struct stat dir_st;
+	if (stat(theme_directory.c_str(), &dir_st) != 0)
+		return nullptr;
+
+	string filename = theme_directory+"/icon-theme.cache";
+	int fd = ::open(filename.c_str(), O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return nullptr;
+
+	struct stat st;
+	// Like GTK, a cache older than its directory is stale.
+	if (fstat(fd, &st) != 0 or st.st_mtime < dir_st.st_mtime or st.st_size < 12) {
+		close(fd);
+		return nullptr;
+	}
+
+	void * p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return nullptr;
+
+	unique_ptr<icon_cache> ret{new icon_cache};
+	ret->_data = static_cast<char const *>(p);
+	ret->_size = st.st_size;
+
+	if (ret->_u16(0) != 1 or ret->_u16(2) != 0)
+		return nullptr;
+
+	ret->_hash_offset = ret->_u32(4);
+	ret->_directory_list_offset = ret->_u32(8);
+
+	if (not ret->_valid(ret->_hash_offset, 4)
+			or not ret->_valid(ret->_directory_list_offset, 4))
+		return nullptr;
+
+	ret->_n_buckets = ret->_u32(ret->_hash_offset);
+	ret->_n_directories = ret->_u32(ret->_directory_list_offset);
+
+	if (not ret->_valid(uint64_t{ret->_hash_offset}+4, uint64_t{ret->_n_buckets}*4)
+			or not ret->_valid(uint64_t{ret->_directory_list_offset}+4, uint64_t{ret->_n_directories}*4))
+		return nullptr;
+
+	return ret;
+}
+
+bool icon_cache::_string(uint32_t offset, string_view & out) const
+{
+	if (offset >= _size)
+		return false;
+	auto end = static_cast<char const *>(memchr(_data+offset, 0, _size-offset));
+	if (end == nullptr)
+		return false;
+	out = string_view{_data+offset, end};
+	return true;
+}
+
+string_view icon_cache::directory(uint32_t index) const
+{
+	string_view ret;
+	if (index < _n_directories)
+		_string(_u32(_directory_list_offset+4+index*4), ret);
+	return ret;
+}
+
+} // namespace xdg
@@ -0,0 +1,173 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SRC_XDG_ICON_CACHE_HXX_
+#define SRC_XDG_ICON_CACHE_HXX_
+
+#include <string>
+#include <memory>
+#include <cstdint>
+
+#include "xdg-utils.hxx"
+
+namespace xdg {
+
+/**
+ * Read-only access to the icon-theme.cache generated by
+ * gtk-update-icon-cache. The file is mmaped and all lookups are done
+ * within the mapping, all integers are big endian:
+ *
+ *   Header:        u16 major, u16 minor, u32 hash offset, u32 directory list offset
+ *   DirectoryList: u32 n, u32 offset[n] to NUL terminated directory names
+ *   Hash:          u32 n_buckets, u32 icon offset[n_buckets]
+ *   Icon:          u32 chain offset, u32 name offset, u32 image list offset
+ *   ImageList:     u32 n, n x { u16 directory index, u16 flags, u32 data offset }
+ *
+ **/
+class icon_cache {
+	char const * _data;
+	size_t _size;
+
+	uint32_t _hash_offset;
+	uint32_t _n_buckets;
+	uint32_t _directory_list_offset;
+	uint32_t _n_directories;
+
+	icon_cache() : _data{nullptr}, _size{0}, _hash_offset{0}, _n_buckets{0},
+			_directory_list_offset{0}, _n_directories{0} { }
+
+	bool _valid(uint64_t offset, uint64_t length) const
+	{
+		return offset <= _size and length <= _size - offset;
+	}
+
+	uint16_t _u16(uint32_t offset) const
+	{
+		auto p = reinterpret_cast<unsigned char const *>(_data+offset);
+		return (p[0] << 8) | p[1];
+	}
+
+	uint32_t _u32(uint32_t offset) const
+	{
+		auto p = reinterpret_cast<unsigned char const *>(_data+offset);
+		return (uint32_t{p[0]} << 24) | (uint32_t{p[1]} << 16) | (uint32_t{p[2]} << 8) | p[3];
+	}
+
+	bool _string(uint32_t offset, string_view & out) const;
+
+	// Call f(directory_index, flags) for each image of the icon at offset.
+	template<typename F>
+	bool _images(uint32_t offset, F && f) const
+	{
+		uint32_t image_list = _u32(offset+8);
+		if (not _valid(image_list, 4))
+			return false;
+		uint32_t n_images = _u32(image_list);
+		if (not _valid(uint64_t{image_list}+4, uint64_t{n_images}*8))
+			return false;
+		for (uint32_t i = 0; i < n_images; ++i) {
+			uint32_t image = image_list+4+i*8;
+			f(_u16(image), _u16(image+2));
+		}
+		return true;
+	}
+
+public:
+
+	enum : uint16_t {
+		HAS_SUFFIX_XPM = 1 << 0,
+		HAS_SUFFIX_SVG = 1 << 1,
+		HAS_SUFFIX_PNG = 1 << 2,
+		HAS_ICON_FILE  = 1 << 3
+	};
+
+	~icon_cache();
+
+	icon_cache(icon_cache const &) = delete;
+	icon_cache & operator=(icon_cache const &) = delete;
+
+	/**
+	 * Open theme_directory/icon-theme.cache, return nullptr if the cache
+	 * is missing, invalid or older than theme_directory.
+	 **/
+	static std::unique_ptr<icon_cache> open(std::string const & theme_directory);
+
+	uint32_t directory_count() const { return _n_directories; }
+	string_view directory(uint32_t index) const;
+
+	/**
+	 * Call f(directory_index, flags) for each image of the icon name, return
+	 * false if the icon is not in the cache.
+	 **/
+	template<typename F>
+	bool lookup(string_view const & name, F && f) const
+	{
+		if (_n_buckets == 0 or name.empty())
+			return false;
+
+		// Same hash as GTK, on signed chars.
+		uint32_t h = static_cast<signed char>(name[0]);
+		for (size_t i = 1; i < name.size(); ++i)
+			h = (h << 5) - h + static_cast<signed char>(name[i]);
+
+		uint32_t offset = _u32(_hash_offset+4+(h%_n_buckets)*4);
+		// Guard against loops in a corrupted chain.
+		for (uint32_t guard = 0; offset != 0xffffffffu and guard < _size; ++guard) {
+			if (not _valid(offset, 12))
+				return false;
+			string_view icon_name;
+			if (not _string(_u32(offset+4), icon_name))
+				return false;
+			if (icon_name == name)
+				return _images(offset, f);
+			offset = _u32(offset);
+		}
+		return false;
+	}
+
+	/**
+	 * Call f(name, directory_index, flags) for each image of each icon, stop
+	 * at the first corrupted entry.
+	 **/
+	template<typename F>
+	void for_each(F && f) const
+	{
+		for (uint32_t bucket = 0; bucket < _n_buckets; ++bucket) {
+			uint32_t offset = _u32(_hash_offset+4+bucket*4);
+			for (uint32_t guard = 0; offset != 0xffffffffu and guard < _size; ++guard) {
+				string_view name;
+				if (not _valid(offset, 12) or not _string(_u32(offset+4), name))
+					return;
+				bool ok = _images(offset, [&](uint16_t dir, uint16_t flags) {
+					f(name, dir, flags);
+				});
+				if (not ok)
+					return;
+				offset = _u32(offset);
+			}
+		}
+	}
+
+};
+
+} // namespace xdg
+
+#endif /* SRC_XDG_ICON_CACHE_HXX_ */
@@ -0,0 +1,216 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "xdg-icon-client.hxx"
+#include "xdg-icon-protocol.hxx"
+
+#include <cstring>
+#include <cerrno>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <unistd.h>
+}
+
+namespace xdg {
+
+using namespace std;
+
+static string const undef{"undef"};
+
+auto icon_client::default_socket_path() -> string
+{
+	return icon_protocol::default_socket_path();
+}
+
+icon_client::icon_client(string const & socket_path) :
+	_socket_path{socket_path},
+	_fd{-1}
+{
+	_connect();
+}
+
+icon_client::~icon_client()
+{
+	_disconnect();
+}
+
+auto icon_client::_connect() -> void
+{
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	if (_socket_path.size() >= sizeof addr.sun_path)
+		return;
+	memcpy(addr.sun_path, _socket_path.c_str(), _socket_path.size()+1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return;
+	if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) != 0
+			or not icon_protocol::is_same_user(fd)) {
+		close(fd);
+		return;
+	}
+
+	// A stalled server is handled like a missing one.
+	timeval timeout;
+	timeout.tv_sec = icon_protocol::client_timeout_ms/1000;
+	timeout.tv_usec = (icon_protocol::client_timeout_ms%1000)*1000;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+	_fd = fd;
+}
+
+auto icon_client::_disconnect() -> void
+{
+	if (_fd >= 0)
+		close(_fd);
+	_fd = -1;
+	_input.clear();
+}
+
+auto icon_client::reconnect() -> bool
+{
+	_disconnect();
+	_connect();
+	return connected();
+}
+
+auto icon_client::_send(string const & data) -> bool
+{
+	size_t sent = 0;
+	while (sent < data.size()) {
+		auto n = send(_fd, data.data()+sent, data.size()-sent, MSG_NOSIGNAL);
+		if (n < 0 and errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		sent += n;
+	}
+	return true;
+}
+
+auto icon_client::_read_line(string & line) -> bool
+{
+	for (;;) {
+		auto eol = _input.find('\n');
+		if (eol != string::npos) {
+			line.assign(_input, 0, eol);
+			_input.erase(0, eol+1);
+			return true;
+		}
+		char buffer[4096];
+		auto n = recv(_fd, buffer, sizeof buffer, 0);
+		if (n < 0 and errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		_input.append(buffer, n);
+	}
+}
+
+auto icon_client::_local_theme(string const & identifier) -> theme &
+{
+	auto & ret = _themes[identifier];
+	if (not ret)
+		ret.reset(new theme{identifier, theme::default_cache_capacity, theme::lazy});
+	return *ret;
+}
+
+auto icon_client::find_icon(string const & identifier, string const & name, int size, int scale) -> string
+{
+	return find_icons(identifier, {icon_request{name, size, scale}}).front();
+}
+
+auto icon_client::find_icons(string const & identifier, vector<icon_request> const & requests) -> vector<string>
+{
+	bool valid = icon_protocol::is_valid_field(identifier);
+	for (auto & r: requests)
+		valid = valid and icon_protocol::is_valid_field(r.name);
+
+	if (connected() and valid) {
+		string batch;
+		for (auto & r: requests) {
+			batch.append("icon\t").append(identifier).append(1, '\t')
+				.append(to_string(r.size)).append(1, '\t')
+				.append(to_string(r.scale)).append(1, '\t')
+				.append(r.name).append(1, '\n');
+		}
+
+		vector<string> ret(requests.size());
+		bool ok = _send(batch);
+		for (size_t i = 0; ok and i < requests.size(); ++i)
+			ok = _read_line(ret[i]);
+		if (ok)
+			return ret;
+		// The server went away, from now on lookups are local.
+		_disconnect();
+	}
+
+	return _local_theme(identifier).find_icons(requests);
+}
+
+auto icon_client::list_applications(string const & lang, vector<string> const & keys) -> vector<desktop_file>
+{
+	bool valid = icon_protocol::is_valid_field(lang);
+	string key_list;
+	for (auto & k: keys) {
+		valid = valid and icon_protocol::is_valid_field(k) and k.find(',') == string::npos;
+		key_list.append(key_list.empty()?"":",").append(k);
+	}
+
+	if (connected() and valid) {
+		vector<desktop_file> ret;
+		bool ok = _send("apps\t"+lang+"\t"+key_list+"\n");
+		string line;
+		group * entries = nullptr;
+		while (ok and (ok = _read_line(line)) and line != "end") {
+			auto tab = line.find('\t');
+			if (tab == string::npos) {
+				ok = false;
+			} else if (line.compare(0, tab, "file") == 0) {
+				ret.emplace_back();
+				ret.back().filename = line.substr(tab+1);
+				entries = &ret.back()["Desktop Entry"];
+			} else if (entries) {
+				auto & e = (*entries)[line.substr(0, tab)];
+				e.score = 0;
+				e.data = line.substr(tab+1);
+			}
+		}
+		if (ok)
+			return ret;
+		_disconnect();
+	}
+
+	vector<desktop_file> ret;
+	desktop_file::for_each_application(lang, keys, [&ret](desktop_file const & f) {
+		ret.push_back(f);
+	});
+	return ret;
+}
+
+} // namespace xdg
@@ -0,0 +1,89 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef SRC_XDG_ICON_CLIENT_HXX_
+#define SRC_XDG_ICON_CLIENT_HXX_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+
+#include "xdg-icon-theme.hxx"
+#include "xdg-desktop-file.hxx"
+
+namespace xdg {
+
+/**
+ * Icon and application lookups served by xdg-icon-server when it is
+ * reachable, which keep warm indexes for all its clients. Without server,
+ * or if the connection is lost, lookups are done in process with lazy
+ * themes built on first use. A server that does not answer within 2
+ * seconds or that does not run as the same user is handled as missing.
+ * An icon_client is not thread safe.
+ **/
+class icon_client {
+	std::string _socket_path;
+	int _fd; //< -1 when not connected.
+	std::string _input; //< received but not yet consumed.
+	std::map<std::string, std::unique_ptr<theme>> _themes; //< in process fallback.
+
+	auto _connect() -> void;
+	auto _disconnect() -> void;
+	auto _send(std::string const & data) -> bool;
+	auto _read_line(std::string & line) -> bool;
+	auto _local_theme(std::string const & identifier) -> theme &;
+
+public:
+	// Path used by the server when none is given.
+	static auto default_socket_path() -> std::string;
+
+	icon_client(std::string const & socket_path = default_socket_path());
+	~icon_client();
+
+	icon_client(icon_client const &) = delete;
+	icon_client & operator=(icon_client const &) = delete;
+
+	// Whether lookups currently go through the server.
+	auto connected() const -> bool { return _fd >= 0; }
+
+	// Try to connect again, return connected().
+	auto reconnect() -> bool;
+
+	// Same as theme::find_icon on the identifier theme.
+	auto find_icon(std::string const & identifier, std::string const & name, int size, int scale) -> std::string;
+
+	// Same as theme::find_icons, sent to the server as a single batch.
+	auto find_icons(std::string const & identifier, std::vector<icon_request> const & requests) -> std::vector<std::string>;
+
+	/**
+	 * Applications with only the listed keys of their [Desktop Entry]
+	 * group, see desktop_file::for_each_application. Files come in no
+	 * particular order.
+	 **/
+	auto list_applications(std::string const & lang, std::vector<std::string> const & keys) -> std::vector<desktop_file>;
+
+};
+
+} // namespace xdg
+
+#endif /* SRC_XDG_ICON_CLIENT_HXX_ */
@@ -0,0 +1,96 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef SRC_XDG_ICON_PROTOCOL_HXX_
+#define SRC_XDG_ICON_PROTOCOL_HXX_
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+}
+
+namespace xdg {
+
+/**
+ * Protocol between icon_client and xdg-icon-server, over a Unix stream
+ * socket. Each request is one line of tab separated fields, responses are
+ * sent in request order thus a client can send a whole batch before
+ * reading any response:
+ *
+ *   icon <theme> <size> <scale> <name>  ->  <path or undef>
+ *   apps <lang> <key,key,...>           ->  file <path>
+ *                                           <key> <raw value>  (for each kept key)
+ *                                           ...
+ *                                           end
+ *
+ * An empty key list keep the whole [Desktop Entry] group, like
+ * desktop_file::for_each_application. Unknown requests get "error".
+ *
+ * Both sides only talk to a peer running as the same user, the socket
+ * path may be in /tmp where anyone can bind it first.
+ **/
+namespace icon_protocol {
+
+// $XDG_RUNTIME_DIR/libxdg-icon-server, or a per user path in /tmp.
+inline std::string default_socket_path()
+{
+	char const * XDG_RUNTIME_DIR = std::getenv("XDG_RUNTIME_DIR");
+	if (XDG_RUNTIME_DIR and XDG_RUNTIME_DIR[0] == '/')
+		return std::string{XDG_RUNTIME_DIR}+"/libxdg-icon-server";
+	return "/tmp/libxdg-icon-server-"+std::to_string(getuid());
+}
+
+// Client send and receive timeout, the client falls back in process after it.
+int const client_timeout_ms = 2000;
+
+// Longest request line the server accepts.
+size_t const max_request_size = 64*1024;
+
+// The server stops reading requests of a client while that much is not sent yet.
+size_t const max_pending_output = 4*1024*1024;
+
+// Whether the process on the other side of the connected socket fd runs as us.
+inline bool is_same_user(int fd)
+{
+	struct ucred cred;
+	socklen_t size = sizeof cred;
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &size) != 0 or size != sizeof cred)
+		return false;
+	return cred.uid == getuid();
+}
+
+// Fields cannot hold the separators.
+inline bool is_valid_field(std::string const & s)
+{
+	return s.find_first_of("\t\n") == std::string::npos;
+}
+
+} // namespace icon_protocol
+
+} // namespace xdg
+
+#endif /* SRC_XDG_ICON_PROTOCOL_HXX_ */
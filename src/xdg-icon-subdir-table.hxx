@@ -0,0 +1,176 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SRC_XDG_ICON_SUBDIR_TABLE_HXX_
+#define SRC_XDG_ICON_SUBDIR_TABLE_HXX_
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+#include "xdg-mapped-desktop-file.hxx"
+
+namespace xdg {
+
+// v clamped to the int range, sizes from files and clients may overflow.
+inline int clamp_to_int(int64_t v)
+{
+	return static_cast<int>(std::min<int64_t>(std::max<int64_t>(v, std::numeric_limits<int>::min()),
+			std::numeric_limits<int>::max()));
+}
+
+// One subdir group of an index.theme, as written in the file.
+struct subdir_rule {
+	enum : uint8_t {
+		TYPE_UNKNOWN   = 0,
+		TYPE_THRESHOLD = 1,
+		TYPE_FIXED     = 2,
+		TYPE_SCALABLE  = 3
+	};
+
+	std::string name;
+	uint8_t type;
+	int size;
+	int scale;
+	int min_size;
+	int max_size;
+
+	subdir_rule(std::string const & name, mapped_group const & subdir) :
+		name{name}
+	{
+		size  = subdir.getattr<int>("Size");
+		scale = subdir.getattr<int>("Scale", 1);
+
+		std::string stype = subdir.getattr<std::string>("Type", "Threshold");
+
+		// All types are reduced to a range of sizes.
+		if (stype == "Threshold") {
+			int threshold = subdir.getattr<int>("Threshold", 2);
+			min_size = clamp_to_int(int64_t{size}-threshold);
+			max_size = clamp_to_int(int64_t{size}+threshold);
+			type = TYPE_THRESHOLD;
+		} else if (stype == "Scalable") {
+			min_size = subdir.getattr<int>("MinSize", size);
+			max_size = subdir.getattr<int>("MaxSize", size);
+			type = TYPE_SCALABLE;
+		} else if (stype == "Fixed") {
+			min_size = size;
+			max_size = size;
+			type = TYPE_FIXED;
+		} else {
+			// Dropped by subdir_table.
+			min_size = 0;
+			max_size = 0;
+			type = TYPE_UNKNOWN;
+		}
+	}
+
+};
+
+/**
+ * Subdir rules of a theme as a structure of arrays sorted by scale then
+ * size, subdirs with the same scale and size keep the Directories order.
+ * The index of a subdir within the table is its id.
+ *
+ * Fixed, Threshold and Scalable rules all match a range of sizes at one
+ * scale, thus match and distance are the same arithmetic for every type
+ * and evaluating the whole table is a loop without indirect calls. Subdirs
+ * of unknown type never match and are not in the table.
+ **/
+struct subdir_table {
+	std::vector<std::string> names;
+	std::vector<uint8_t> types;
+	std::vector<int> sizes;
+	std::vector<int> scales;
+	std::vector<int> min_sizes;
+	std::vector<int> max_sizes;
+	// min_sizes and max_sizes multiplied by scales, for the distance.
+	std::vector<int64_t> min_scaled;
+	std::vector<int64_t> max_scaled;
+
+	subdir_table() = default;
+
+	subdir_table(std::vector<subdir_rule> rules)
+	{
+		rules.erase(std::remove_if(rules.begin(), rules.end(), [](subdir_rule const & r) {
+			return r.type == subdir_rule::TYPE_UNKNOWN;
+		}), rules.end());
+
+		std::stable_sort(rules.begin(), rules.end(), [](subdir_rule const & a, subdir_rule const & b) {
+			if (a.scale != b.scale)
+				return a.scale < b.scale;
+			return a.size < b.size;
+		});
+
+		for (auto & r: rules) {
+			names.push_back(r.name);
+			types.push_back(r.type);
+			sizes.push_back(r.size);
+			scales.push_back(r.scale);
+			min_sizes.push_back(r.min_size);
+			max_sizes.push_back(r.max_size);
+			min_scaled.push_back(int64_t{r.min_size}*r.scale);
+			max_scaled.push_back(int64_t{r.max_size}*r.scale);
+		}
+	}
+
+	size_t size() const { return names.size(); }
+
+	bool match(size_t s, int size, int scale) const
+	{
+		return (scales[s] == scale) & (min_sizes[s] <= size) & (size <= max_sizes[s]);
+	}
+
+	/**
+	 * Distance of size*scale to the scaled range, computed in 64 bits,
+	 * size*scale is clamped to the int range as icon_size_table does and
+	 * the result to INT_MAX, that never counts as close.
+	 **/
+	int dist(size_t s, int size, int scale) const
+	{
+		int64_t x = clamp_to_int(int64_t{size}*scale);
+		return clamp_to_int(std::max<int64_t>(min_scaled[s]-x, 0) + std::max<int64_t>(x-max_scaled[s], 0));
+	}
+
+	// Match and distance of every subdir for one size, in id order.
+	void evaluate(int size, int scale, char * match, int * dist) const
+	{
+		int const n = names.size();
+		int64_t const x = clamp_to_int(int64_t{size}*scale);
+		int const * sc = scales.data();
+		int const * lo = min_sizes.data();
+		int const * hi = max_sizes.data();
+		int64_t const * los = min_scaled.data();
+		int64_t const * his = max_scaled.data();
+		// Two loops, stores to match may alias the arrays.
+		for (int s = 0; s < n; ++s)
+			dist[s] = clamp_to_int(std::max<int64_t>(los[s]-x, 0) + std::max<int64_t>(x-his[s], 0));
+		for (int s = 0; s < n; ++s)
+			match[s] = (sc[s] == scale) & (lo[s] <= size) & (size <= hi[s]);
+	}
+
+};
+
+} // namespace xdg
+
+#endif /* SRC_XDG_ICON_SUBDIR_TABLE_HXX_ */
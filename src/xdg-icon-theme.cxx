@@ -19,228 +19,894 @@ along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
 
 */
 
-#include <xdg-desktop-file.hxx>
+#include "xdg-mapped-desktop-file.hxx"
 #include "xdg-icon-theme.hxx"
+#include "xdg-icon-cache.hxx"
+#include "xdg-icon-subdir-table.hxx"
+#include "xdg-string-arena.hxx"
+#include "xdg-stats-counters.hxx"
 
 #include "xdg-utils.hxx"
 
 #include <cmath>
 #include <cstdlib>
 #include <cstdint>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <atomic>
 
 extern "C" {
 #include <unistd.h>
+#include <sys/types.h>
+#include <dirent.h>
 }
 
 namespace xdg {
 
 using namespace std;
 
-struct s_subdir_rule {
-	int scale;
-	int size;
+static array<string const, 3> const extensions{{".png", ".svg", ".xpm"}};
+static string const undef{"undef"};
+
+// Return the index of the icon extension of filename, -1 if none.
+static int icon_extension(char const * filename, string & name)
+{
+	auto len = strlen(filename);
+	for (size_t i = 0; i < extensions.size(); ++i) {
+		auto & e = extensions[i];
+		if (len > e.size() and e.compare(0, e.size(), filename+len-e.size()) == 0) {
+			name.assign(filename, len-e.size());
+			return i;
+		}
+	}
+	return -1;
+}
+
+struct theme_index {
+
+	friend struct theme;
+
+	struct invalid_theme_index_file : public std::exception {
+		virtual char const * what() const noexcept override {
+			return "invalid_theme_index_file";
+		}
+	};
+
+	string identifier;
+	vector<string> inherits;
+	subdir_table subdirs; //< icon_location::subdir refer to it.
+	shared_ptr<stats_counters> stats; //< of the theme that loaded it.
+
+	struct icon_location {
+		uint16_t subdir;    //< index within subdirs
+		uint8_t  basedir;   //< index within theme::search_directories
+		uint8_t  extension; //< index within extensions
+
+		bool operator<(icon_location const & x) const
+		{
+			if (subdir != x.subdir)
+				return subdir < x.subdir;
+			if (basedir != x.basedir)
+				return basedir < x.basedir;
+			return extension < x.extension;
+		}
+	};
 
-	union {
-		struct {
-			int min_size;
-			int max_size;
-		};
-		int threshold;
+	// Locations of one icon name, in lookup order.
+	struct icon_locations {
+		icon_location const * first;
+		icon_location const * last;
+
+		icon_location const * begin() const { return first; }
+		icon_location const * end() const { return last; }
+		size_t size() const { return last-first; }
+		bool empty() const { return first == last; }
 	};
 
-	struct s_vtable {
-		bool (s_subdir_rule::*match) (int, int) const;
-		int  (s_subdir_rule::*distance) (int, int) const;
+	struct icon_range {
+		uint32_t first;
+		uint32_t count;
 	};
 
-	enum : char {
-		TYPE_UNKNOWN   = 0,
-		TYPE_THREHOLD  = 1,
-		TYPE_FIXED     = 2,
-		TYPE_SCALABLE  = 3,
-		TYPE_MAX       = 4
-	} type;
+	using found_icon = pair<string_view, icon_location>;
+
+	/**
+	 * Content of the theme directories, the costly part of the index since
+	 * every subdir is read. Immutable once built and shared with the copies
+	 * of the theme_index.
+	 **/
+	struct icon_index {
+		// Icon names, each stored once.
+		unique_ptr<string_arena> names;
+
+		// All icon locations, grouped by icon name, those read from icon
+		// caches included.
+		vector<icon_location> locations;
+
+		// For each available icon name, its locations.
+		unordered_map<string_view, icon_range> icons;
+
+		// Whether the icons of each base directory come from its valid
+		// icon-theme.cache instead of reading its subdirs.
+		vector<bool> cached;
+
+		icon_index() : names{new string_arena} { }
+
+		// Name as stored in names, stored if not already.
+		string_view intern(string_view const & name)
+		{
+			auto x = icons.find(name);
+			if (x == icons.end())
+				x = icons.emplace(names->store(name), icon_range{0, 0}).first;
+			return x->first;
+		}
+
+		// Store found icons in locations, in lookup order.
+		void set_locations(vector<found_icon> & found)
+		{
+			// Names are unique within names, comparing pointers is enough to
+			// group them.
+			sort(found.begin(), found.end(), [](found_icon const & a, found_icon const & b) {
+				if (a.first.data() != b.first.data())
+					return less<char const *>{}(a.first.data(), b.first.data());
+				return a.second < b.second;
+			});
+
+			locations.clear();
+			locations.reserve(found.size());
+			for (auto & x: icons)
+				x.second = icon_range{0, 0};
+			for (size_t i = 0; i < found.size(); ++i) {
+				auto & range = icons.find(found[i].first)->second;
+				if (range.count == 0)
+					range.first = i;
+				range.count += 1;
+				locations.push_back(found[i].second);
+			}
+
+			for (auto x = icons.begin(); x != icons.end();) {
+				if (x->second.count == 0)
+					x = icons.erase(x);
+				else
+					++x;
+			}
+		}
+
+		// All indexed icons whose location satisfies keep.
+		template<typename F>
+		vector<found_icon> get_locations_if(F && keep) const
+		{
+			vector<found_icon> ret;
+			ret.reserve(locations.size());
+			for (auto & x: icons) {
+				for (uint32_t i = x.second.first; i < x.second.first+x.second.count; ++i) {
+					auto & l = locations[i];
+					if (keep(l))
+						ret.emplace_back(x.first, l);
+				}
+			}
+			return ret;
+		}
+
+	};
 
-	static s_vtable const _api[TYPE_MAX];
+	// In lazy mode the icon index is built by the first lookup that need it.
+	mutable mutex _icons_lock;
+	mutable atomic<icon_index const *> _icons_ready; //< _icons once published.
+	mutable shared_ptr<icon_index const> _icons;
 
+	theme_index() : _icons_ready{nullptr} { }
 
-	bool match_unknown(int size, int scale) const
+	// Copies share the icon index, if already built.
+	theme_index(theme_index const & x) :
+		identifier{x.identifier},
+		inherits{x.inherits},
+		subdirs{x.subdirs},
+		stats{x.stats},
+		_icons_ready{nullptr}
 	{
-		return false;
+		lock_guard<mutex> l{x._icons_lock};
+		set_icon_index(x._icons);
 	}
 
-	bool match_fixed(int size, int scale) const
+	// Icons of subdirs[s] within search_directories[b], appended to found.
+	void read_subdir(icon_index & index, vector<string> const & search_directories, size_t s, size_t b, vector<found_icon> & found) const
 	{
-		if (scale != this->scale)
-			return false;
-		return this->size == size;
+		auto & base = search_directories[b];
+		auto & subdir = subdirs.names[s];
+		string path;
+		path.reserve(base.size()+identifier.size()+subdir.size()+2);
+		path.append(base).append(1, '/').append(identifier).append(1, '/').append(subdir);
+		stats_counters::add(stats->directories_read);
+		DIR * dir = opendir(path.c_str());
+		if (dir == nullptr)
+			return;
+		string name;
+		struct dirent * p;
+		while((p = readdir(dir)) != nullptr) {
+			if (p->d_name[0] == '.')
+				continue;
+			int e = icon_extension(p->d_name, name);
+			if (e < 0)
+				continue;
+			found.emplace_back(index.intern(string_view{name}), icon_location{static_cast<uint16_t>(s),
+				static_cast<uint8_t>(b), static_cast<uint8_t>(e)});
+		}
+		closedir(dir);
 	}
 
-	bool match_scaled(int size, int scale) const
+	/**
+	 * Index again subdirs[s] within search_directories[b] after it changed.
+	 * An icon cache cannot be updated, it is dropped and its base directory
+	 * is indexed by reading its subdirs. Names are stored again in a new
+	 * arena, thus removed icons do not accumulate over updates.
+	 **/
+	shared_ptr<icon_index const> update_subdir(icon_index const & x, vector<string> const & search_directories, size_t s, size_t b) const
 	{
-		if (scale != this->scale)
-			return false;
-		return min_size <= size and size <= max_size;
+		shared_ptr<icon_index> ret{new icon_index};
+		ret->cached = x.cached;
+		bool cached = x.cached[b];
+		auto found = x.get_locations_if([&](icon_location const & l) {
+			return l.basedir != b or (l.subdir != s and not cached);
+		});
+		for (auto & f: found)
+			f.first = ret->intern(f.first);
+		if (cached) {
+			ret->cached[b] = false;
+			for (size_t i = 0; i < subdirs.size(); ++i)
+				read_subdir(*ret, search_directories, i, b, found);
+		} else {
+			read_subdir(*ret, search_directories, s, b, found);
+		}
+		ret->set_locations(found);
+		return ret;
+	}
+
+	// Read each subdir once, to avoid probing files on each lookup.
+	shared_ptr<icon_index const> build_icon_index(vector<string> const & search_directories) const
+	{
+		scoped_timer timer{stats->index_build};
+		shared_ptr<icon_index> ret{new icon_index};
+
+		unordered_map<string_view, int> subdir_ids;
+		for (size_t s = 0; s < subdirs.size(); ++s)
+			subdir_ids[string_view{subdirs.names[s]}] = s;
+
+		vector<found_icon> found;
+		ret->cached.resize(search_directories.size(), false);
+		for (size_t b = 0; b < search_directories.size(); ++b) {
+			stats_counters::add(stats->stat_calls);
+			auto cache = icon_cache::open(search_directories[b]+"/"+identifier);
+			if (not cache)
+				continue;
+			ret->cached[b] = true;
+			// Map cache directory index to subdirs index or -1.
+			vector<int> cache_subdirs;
+			for (uint32_t i = 0; i < cache->directory_count(); ++i) {
+				auto x = subdir_ids.find(cache->directory(i));
+				cache_subdirs.push_back(x == subdir_ids.end()?-1:x->second);
+			}
+			// Merged here once, lookups only see the index.
+			auto base = static_cast<uint8_t>(b);
+			cache->for_each([&](string_view const & name, uint16_t dir, uint16_t flags) {
+				if (dir >= cache_subdirs.size() or cache_subdirs[dir] < 0)
+					return;
+				auto s = static_cast<uint16_t>(cache_subdirs[dir]);
+				auto icon = ret->intern(name);
+				if (flags & icon_cache::HAS_SUFFIX_PNG)
+					found.emplace_back(icon, icon_location{s, base, 0});
+				if (flags & icon_cache::HAS_SUFFIX_SVG)
+					found.emplace_back(icon, icon_location{s, base, 1});
+				if (flags & icon_cache::HAS_SUFFIX_XPM)
+					found.emplace_back(icon, icon_location{s, base, 2});
+			});
+		}
+
+		for (size_t s = 0; s < subdirs.size(); ++s) {
+			for (size_t b = 0; b < search_directories.size(); ++b) {
+				if (not ret->cached[b])
+					read_subdir(*ret, search_directories, s, b, found);
+			}
+		}
+		ret->set_locations(found);
+		return ret;
 	}
 
-	bool match_threshold(int size, int scale) const
+	// Only valid before the index is shared, or with _icons_lock held.
+	void set_icon_index(shared_ptr<icon_index const> const & x) const
 	{
-		if (scale != this->scale)
-			return false;
-		return std::abs(size-this->size) <= threshold;
+		_icons = x;
+		_icons_ready.store(x.get(), memory_order_release);
 	}
 
-	int dist_unknown(int size, int scale) const
+	// Return the icon index if already built, nullptr otherwise.
+	icon_index const * built_icon_index() const
 	{
-		return std::numeric_limits<int>::max();
+		return _icons_ready.load(memory_order_acquire);
 	}
 
-	int dist_fixed(int size, int scale) const
+	// Return the icon index, build it on first use.
+	icon_index const & get_icon_index(vector<string> const & search_directories) const
 	{
-		return std::abs(this->size*this->scale-size*scale);
+		auto ret = built_icon_index();
+		if (ret)
+			return *ret;
+		lock_guard<mutex> l{_icons_lock};
+		if (not _icons)
+			set_icon_index(build_icon_index(search_directories));
+		return *_icons;
 	}
 
-	int dist_scaled(int size, int scale) const
+	// Return all locations of the icon name in lookup order.
+	icon_locations find_icon_locations(vector<string> const & search_directories, string const & name) const
 	{
-		if (size*scale < this->min_size*this->scale)
-			return this->min_size*this->scale - size*scale;
-		if (size*scale > this->max_size*this->scale)
-			return size*scale - this->max_size*this->scale;
-		return 0;
+		auto & index = get_icon_index(search_directories);
+		icon_locations ret{nullptr, nullptr};
+		auto icon = index.icons.find(string_view{name});
+		if (icon != index.icons.end()) {
+			ret.first = index.locations.data()+icon->second.first;
+			ret.last = ret.first+icon->second.count;
+		}
+		return ret;
 	}
 
+};
 
-	int dist_threshold(int size, int scale) const
+/**
+ * Immutable state of a theme once built, shared by all lookups. A theme
+ * can be updated by building a new snapshot and swapping it.
+ **/
+struct theme_snapshot {
+	uint64_t generation; //< unique for each snapshot.
+	string identifier;
+	bool lazy; //< icon indexes are built on first use.
+	shared_ptr<stats_counters> stats;
+	vector<string> search_directories;
+	vector<string> missing_directories; //< search directories that do not exist.
+	// Loaded themes, shared with the snapshots built from this one.
+	unordered_map<string, shared_ptr<theme_index const>> theme_index_cache;
+	vector<theme_index const *> lookup_list;
+
+	// icons directly in search_directories, name -> (basedir, extension),
+	// built on first use in lazy mode.
+	mutable mutex _fallback_lock;
+	mutable atomic<bool> _fallback_ready;
+	mutable unordered_map<string, pair<int, int>> _fallback_icons;
+
+	auto _load_theme_index(string const & identifier) const -> shared_ptr<theme_index const>;
+	auto _get_theme_index(string const & identifier) -> theme_index const *;
+	auto _lookup_for_theme_index_file(string const & identifier) const -> string;
+	auto _build_lookup_list() -> void;
+	auto _append_lookup_list(string const & identifier) -> void;
+	auto _is_referenced(string const & identifier) const -> bool;
+	auto _build_fallback_index() const -> void;
+	auto _get_fallback_icons() const -> unordered_map<string, pair<int, int>> const &;
+	auto _update_fallback(string const & name) -> void;
+	auto _lookup_icon_in_theme(theme_index const & theme, string const & name, int size, int scale) const -> string;
+	auto _lookup_fallback(string const & name) const -> string;
+
+	theme_snapshot(string const & identifier, bool lazy, shared_ptr<stats_counters> const & stats);
+
+	// Copy to be updated, with a new generation.
+	theme_snapshot(theme_snapshot const & x);
+
+	/**
+	 * Apply the changes of files or directories in paths, return false if
+	 * none of them are relevant for this theme.
+	 **/
+	auto update(vector<string> const & paths) -> bool;
+
+	auto watched_directories() const -> vector<string>;
+
+	// Whether a missing search directory is in paths, thus a new snapshot is needed.
+	auto has_new_search_directory(vector<string> const & paths) const -> bool;
+
+	auto find_icon(string const & name, int size, int scale) const -> string;
+
+	auto find_icon_variants(string const & name) const -> vector<icon_variant>;
+
+	// Resolve requests[i] for each i in todo into results[i].
+	auto find_icons(vector<icon_request> const & requests, vector<size_t> const & todo, vector<string> & results) const -> void;
+
+	// Build the path with a single allocation.
+	auto _make_path(theme_index const & theme, theme_index::icon_location const & l, string const & name) const -> string
 	{
-		if (size*scale < (this->size-this->threshold)*this->scale)
-			return (this->size-this->threshold)*this->scale - size*scale;
-		if (size*scale > (this->size+this->threshold)*this->scale)
-			return size*scale - (this->size+this->threshold)*this->scale;
-		return 0;
+		auto & base = search_directories[l.basedir];
+		auto & subdir = theme.subdirs.names[l.subdir];
+		auto & ext = extensions[l.extension];
+		string ret;
+		ret.reserve(base.size()+theme.identifier.size()+subdir.size()+name.size()+ext.size()+3);
+		ret.append(base).append(1, '/').append(theme.identifier).append(1, '/')
+				.append(subdir).append(1, '/').append(name).append(ext);
+		return ret;
 	}
 
-	s_subdir_rule & operator=(s_subdir_rule const &) = default;
-	s_subdir_rule(s_subdir_rule const &) = default;
-	s_subdir_rule() {
-		type = TYPE_UNKNOWN;
+};
+
+/**
+ * Select the icon location as defined by the XDG lookup, first exact
+ * match, else the closest one. Return nullptr if locations is empty.
+ **/
+template<typename M, typename D>
+static theme_index::icon_location const * select_icon_location(
+		theme_index::icon_locations const & locations, M && match, D && dist)
+{
+	// First pass exact match
+	for (auto & l: locations) {
+		if (match(l))
+			return &l;
 	}
 
-	s_subdir_rule(group const & subdir)
-	{
-		size  = subdir.getattr<int>("Size");
-		scale = subdir.getattr<int>("Scale", 1);
-
-		string stype = subdir.getattr<string>("Type", "Threshold");
-
-		if (stype == "Threshold") {
-			threshold = subdir.getattr<int>("Threshold", 2);
-			type = TYPE_THREHOLD;
-		} else if (stype == "Scalable") {
-			min_size = subdir.getattr<int>("MinSize", size);
-			max_size = subdir.getattr<int>("MaxSize", size);
-			type = TYPE_SCALABLE;
-		} else if (stype == "Fixed") {
-			type = TYPE_FIXED;
-		} else {
-			// Unknown type
-			cout << "WARNING: unexpected subdir type" << endl;
-			type = TYPE_UNKNOWN;
+	// Second pass best match, nothing is closer than a distance of 0.
+	int subdir_distance = std::numeric_limits<int>::max();
+	theme_index::icon_location const * ret = nullptr;
+	for (auto & l: locations) {
+		int d = dist(l);
+		if (d < subdir_distance) {
+			subdir_distance = d;
+			ret = &l;
+			if (d == 0)
+				break;
 		}
 	}
+	return ret;
+}
 
-	bool match(int size, int scale) const
-	{
-		return (this->*_api[type].match)(size, scale);
+static atomic<uint64_t> theme_snapshot_generation{0};
+
+theme::~theme()
+{
+
+}
+
+theme::theme(string const & identifier, size_t cache_capacity, loading mode) :
+	identifier{identifier},
+	_lazy{mode == lazy},
+	_stats{make_shared<stats_counters>()},
+	_state{new _locked_state}
+{
+	scoped_allocation_account account{_stats->allocations};
+	set_cache_capacity(cache_capacity);
+	_set_snapshot(make_shared<theme_snapshot>(identifier, _lazy, _stats));
+}
+
+auto theme::_get_snapshot() const -> shared_ptr<theme_snapshot const>
+{
+	return atomic_load(&_snapshot);
+}
+
+auto theme::_set_snapshot(shared_ptr<theme_snapshot const> const & snapshot) -> void
+{
+	// Cached results of the previous snapshot are dropped lazily, see
+	// find_icon.
+	atomic_store(&_snapshot, snapshot);
+}
+
+auto theme::_get_cache_shard(string const & name) const -> _cache_shard &
+{
+	return _state->cache[hash<string>{}(name)%_state->cache.size()];
+}
+
+auto theme::_cache_insert(_cache_shard & shard, uint64_t generation, _cache_key const & key, string const & value) -> void
+{
+	// The snapshot may have changed while the lookup was running.
+	if (shard.generation != generation or shard.capacity == 0)
+		return;
+	if (shard.results.find(key) != shard.results.end())
+		return;
+	if (shard.lru.size() >= shard.capacity) {
+		_cache_evict(shard, prev(shard.lru.end()));
+		shard.evictions += 1;
 	}
+	shard.lru.push_front(_cache_shard::entry{key.name.to_string(), key.size, key.scale, value});
+	auto & e = shard.lru.front();
+	shard.results[_cache_key{string_view{e.name}, e.size, e.scale}] = shard.lru.begin();
+}
+
+auto theme::_cache_evict(_cache_shard & shard, list<_cache_shard::entry>::iterator x) -> list<_cache_shard::entry>::iterator
+{
+	shard.results.erase(_cache_key{string_view{x->name}, x->size, x->scale});
+	return shard.lru.erase(x);
+}
+
+string theme::find_icon(string const & name, int size, int scale) const
+{
+	scoped_allocation_account account{_stats->allocations};
+	auto snapshot = _get_snapshot();
+	if (_state->cache_capacity.load(memory_order_relaxed) == 0)
+		return snapshot->find_icon(name, size, scale);
+
+	_cache_key key{string_view{name}, size, scale};
 
-	int dist(int size, int scale) const
+	auto & shard = _get_cache_shard(name);
 	{
-		return (this->*_api[type].distance)(size, scale);
+		lock_guard<mutex> l{shard.lock};
+		if (shard.generation != snapshot->generation) {
+			shard.clear();
+			shard.generation = snapshot->generation;
+		}
+		auto x = shard.results.find(key);
+		if (x != shard.results.end()) {
+			shard.hits += 1;
+			shard.lru.splice(shard.lru.begin(), shard.lru, x->second);
+			return x->second->value;
+		}
+		shard.misses += 1;
 	}
 
+	// The lookup itself is done without any lock.
+	string ret = snapshot->find_icon(name, size, scale);
 
-};
+	{
+		lock_guard<mutex> l{shard.lock};
+		_cache_insert(shard, snapshot->generation, key, ret);
+	}
 
-s_subdir_rule::s_vtable const s_subdir_rule::_api[TYPE_MAX]  = {
-		{&s_subdir_rule::match_unknown, &s_subdir_rule::dist_unknown},
-		{&s_subdir_rule::match_threshold, &s_subdir_rule::dist_threshold},
-		{&s_subdir_rule::match_fixed, &s_subdir_rule::dist_fixed},
-		{&s_subdir_rule::match_scaled, &s_subdir_rule::dist_scaled}
-};
+	return ret;
+}
 
-struct theme_index {
+auto theme::invalidate_cache() const -> void
+{
+	for (auto & shard: _state->cache) {
+		lock_guard<mutex> l{shard.lock};
+		shard.clear();
+	}
+}
 
-	friend struct theme;
+auto theme::invalidate_cache(string const & name) const -> void
+{
+	auto & shard = _get_cache_shard(name);
+	lock_guard<mutex> l{shard.lock};
+	for (auto x = shard.lru.begin(); x != shard.lru.end();) {
+		if (x->name == name)
+			x = _cache_evict(shard, x);
+		else
+			++x;
+	}
+}
 
-	struct invalid_theme_index_file : public std::exception {
-		virtual char const * what() const noexcept override {
-			return "invalid_theme_index_file";
+auto theme::set_cache_capacity(size_t capacity) -> void
+{
+	_state->cache_capacity.store(capacity, memory_order_relaxed);
+	size_t per_shard = (capacity+_state->cache.size()-1)/_state->cache.size();
+	for (auto & shard: _state->cache) {
+		lock_guard<mutex> l{shard.lock};
+		shard.capacity = per_shard;
+		while (shard.lru.size() > per_shard) {
+			_cache_evict(shard, prev(shard.lru.end()));
+			shard.evictions += 1;
 		}
-	};
+	}
+}
 
-	string identifier;
-	vector<theme_index const *> inherits;
-	unordered_map<string, s_subdir_rule> subdir_rules;
+auto theme::get_cache_stats() const -> cache_stats
+{
+	cache_stats ret{0, 0, 0, 0, 0};
+	for (auto & shard: _state->cache) {
+		lock_guard<mutex> l{shard.lock};
+		ret.hits += shard.hits;
+		ret.misses += shard.misses;
+		ret.evictions += shard.evictions;
+		ret.size += shard.lru.size();
+		ret.capacity += shard.capacity;
+	}
+	return ret;
+}
 
-	bool subdir_match(string const & subdir, int size, int scale) const
-	{
-		auto rule = subdir_rules.find(subdir);
-		if (rule == subdir_rules.end())
-			return false;
-		return rule->second.match(size, scale);
+auto theme::get_stats() const -> stats
+{
+	auto ret = _stats->get();
+	for (auto & shard: _state->cache) {
+		lock_guard<mutex> l{shard.lock};
+		ret.cache_hits += shard.hits;
+		ret.cache_misses += shard.misses;
 	}
+	return ret;
+}
 
-};
+auto theme::reset_stats() const -> void
+{
+	_stats->reset();
+	for (auto & shard: _state->cache) {
+		lock_guard<mutex> l{shard.lock};
+		shard.hits = 0;
+		shard.misses = 0;
+		shard.evictions = 0;
+	}
+}
 
+auto theme::update(vector<string> const & paths) -> bool
+{
+	scoped_allocation_account account{_stats->allocations};
+	lock_guard<mutex> l{_state->update_lock};
+	// Indexes refer to search directories by position, start over.
+	if (_get_snapshot()->has_new_search_directory(paths)) {
+		_set_snapshot(make_shared<theme_snapshot>(identifier, _lazy, _stats));
+		return true;
+	}
+	auto snapshot = make_shared<theme_snapshot>(*_get_snapshot());
+	if (not snapshot->update(paths))
+		return false;
+	_set_snapshot(snapshot);
+	return true;
+}
 
-static array<string const, 3> const extensions{{".png", ".svg", ".xpm"}};
-static string const undef{"undef"};
+auto theme::reload() -> void
+{
+	scoped_allocation_account account{_stats->allocations};
+	lock_guard<mutex> l{_state->update_lock};
+	_set_snapshot(make_shared<theme_snapshot>(identifier, _lazy, _stats));
+}
 
-theme::~theme()
+auto theme::watched_directories() const -> vector<string>
+{
+	return _get_snapshot()->watched_directories();
+}
+
+string theme::find_icon_uncached(string const & name, int size, int scale) const
+{
+	scoped_allocation_account account{_stats->allocations};
+	return _get_snapshot()->find_icon(name, size, scale);
+}
+
+auto theme::find_icon_variants(string const & name) const -> vector<icon_variant>
+{
+	scoped_allocation_account account{_stats->allocations};
+	return _get_snapshot()->find_icon_variants(name);
+}
+
+auto theme::icon_sizes(string const & name) const -> icon_size_table
+{
+	scoped_allocation_account account{_stats->allocations};
+	return icon_size_table{find_icon_variants(name)};
+}
+
+auto theme::find_icons(vector<icon_request> const & requests) const -> vector<string>
 {
+	scoped_allocation_account account{_stats->allocations};
+	auto snapshot = _get_snapshot();
+	vector<string> results(requests.size());
+
+	vector<size_t> todo;
+	if (_state->cache_capacity.load(memory_order_relaxed) == 0) {
+		for (size_t i = 0; i < requests.size(); ++i)
+			todo.push_back(i);
+		snapshot->find_icons(requests, todo, results);
+		return results;
+	}
+
+	// Serve what we can from the cache, resolve the rest in one batch.
+	for (size_t i = 0; i < requests.size(); ++i) {
+		auto & r = requests[i];
+		auto & shard = _get_cache_shard(r.name);
+		lock_guard<mutex> l{shard.lock};
+		if (shard.generation != snapshot->generation) {
+			shard.clear();
+			shard.generation = snapshot->generation;
+		}
+		auto x = shard.results.find(_cache_key{string_view{r.name}, r.size, r.scale});
+		if (x != shard.results.end()) {
+			shard.hits += 1;
+			shard.lru.splice(shard.lru.begin(), shard.lru, x->second);
+			results[i] = x->second->value;
+		} else {
+			shard.misses += 1;
+			todo.push_back(i);
+		}
+	}
+
+	if (todo.empty())
+		return results;
+
+	snapshot->find_icons(requests, todo, results);
 
+	for (auto i: todo) {
+		auto & r = requests[i];
+		auto & shard = _get_cache_shard(r.name);
+		lock_guard<mutex> l{shard.lock};
+		_cache_insert(shard, snapshot->generation, _cache_key{string_view{r.name}, r.size, r.scale}, results[i]);
+	}
+
+	return results;
 }
 
-theme::theme(string const & identifier) : identifier{identifier}
+theme_snapshot::theme_snapshot(string const & identifier, bool lazy, shared_ptr<stats_counters> const & stats) :
+	generation{++theme_snapshot_generation},
+	identifier{identifier},
+	lazy{lazy},
+	stats{stats},
+	_fallback_ready{false}
 {
 
 	// Setup theme index searsh directories
-	auto HOME = std::getenv("HOME");
-	if (HOME) {
-		string dir = string{HOME}+"/.icons";
+	auto add_search_directory = [&](string const & dir) {
+		stats_counters::add(stats->access_calls);
 		if (access(dir.c_str(), R_OK) == 0)
 			search_directories.push_back(dir);
-	}
+		else
+			missing_directories.push_back(dir);
+	};
+
+	auto HOME = std::getenv("HOME");
+	if (HOME)
+		add_search_directory(string{HOME}+"/.icons");
 
 	auto XDG_DATA_DIRS = std::getenv("XDG_DATA_DIRS");
 	if (XDG_DATA_DIRS) {
-		for (auto & p: split(XDG_DATA_DIRS, ':')) {
-			string dir = p+"/icons";
-			if (access(dir.c_str(), R_OK) == 0)
-				search_directories.push_back(p+"/icons");
+		for (auto & p: split(XDG_DATA_DIRS, ':'))
+			add_search_directory(p+"/icons");
+	}
+
+	add_search_directory("/usr/share/pixmaps");
+
+	// In lazy mode only index.theme files are read, to know the lookup order.
+	_build_lookup_list();
+	if (not lazy)
+		_get_fallback_icons();
+
+}
+
+theme_snapshot::theme_snapshot(theme_snapshot const & x) :
+	generation{++theme_snapshot_generation},
+	identifier{x.identifier},
+	lazy{x.lazy},
+	stats{x.stats},
+	search_directories{x.search_directories},
+	missing_directories{x.missing_directories},
+	theme_index_cache{x.theme_index_cache},
+	lookup_list{x.lookup_list}
+{
+	lock_guard<mutex> l{x._fallback_lock};
+	_fallback_icons = x._fallback_icons;
+	_fallback_ready = x._fallback_ready.load();
+}
+
+auto theme_snapshot::_is_referenced(string const & identifier) const -> bool
+{
+	if (identifier == this->identifier or identifier == "hicolor")
+		return true;
+	if (theme_index_cache.count(identifier))
+		return true;
+	for (auto & x: theme_index_cache) {
+		auto & inherits = x.second->inherits;
+		if (find(inherits.begin(), inherits.end(), identifier) != inherits.end())
+			return true;
+	}
+	return false;
+}
+
+auto theme_snapshot::update(vector<string> const & paths) -> bool
+{
+	bool changed = false;
+	for (auto & path: paths) {
+		for (size_t b = 0; b < search_directories.size(); ++b) {
+			auto & base = search_directories[b];
+			if (path.size() <= base.size()+1 or path[base.size()] != '/'
+					or path.compare(0, base.size(), base) != 0)
+				continue;
+			string rest = path.substr(base.size()+1);
+
+			auto slash = rest.find('/');
+			if (slash == string::npos) {
+				// An icon or a theme directly within the base directory.
+				string name;
+				if (icon_extension(rest.c_str(), name) >= 0) {
+					_update_fallback(name);
+					changed = true;
+				} else if (_is_referenced(rest)) {
+					theme_index_cache.erase(rest);
+					changed = true;
+				}
+				continue;
+			}
+
+			string id = rest.substr(0, slash);
+			string file = rest.substr(slash+1);
+			if (file == "index.theme") {
+				if (_is_referenced(id)) {
+					theme_index_cache.erase(id);
+					changed = true;
+				}
+				continue;
+			}
+
+			auto x = theme_index_cache.find(id);
+			if (x == theme_index_cache.end())
+				continue;
+
+			shared_ptr<theme_index> t{new theme_index{*x->second}};
+			bool hit = false;
+			if (file == "icon-theme.cache") {
+				t->set_icon_index(lazy?nullptr:t->build_icon_index(search_directories));
+				hit = true;
+			} else {
+				// Either a subdir, one of its parents or a file within a subdir.
+				for (size_t s = 0; s < t->subdirs.size(); ++s) {
+					auto & subdir = t->subdirs.names[s];
+					auto n = min(subdir.size(), file.size());
+					if (file.compare(0, n, subdir, 0, n) != 0)
+						continue;
+					if (file.size() == subdir.size()
+							or (file.size() < subdir.size() and subdir[n] == '/')
+							or (file.size() > subdir.size() and file[n] == '/'
+								and file.find('/', n+1) == string::npos)) {
+						// Not built yet, the build will read the subdir.
+						if (auto icons = t->built_icon_index())
+							t->set_icon_index(t->update_subdir(*icons, search_directories, s, b));
+						hit = true;
+					}
+				}
+			}
+
+			if (hit) {
+				x->second = t;
+				changed = true;
+			}
 		}
 	}
 
-	if (access("/usr/share/pixmap", R_OK) == 0)
-		search_directories.push_back("/usr/share/pixmap");
+	if (not changed)
+		return false;
 
-	lookup_list.push_back(_get_theme_index(identifier));
 	_build_lookup_list();
 
-	auto _hicolor = _get_theme_index("hicolor");
-	if (find(lookup_list.begin(), lookup_list.end(), _hicolor) == lookup_list.end()) {
-		lookup_list.push_back(_hicolor);
-		_build_lookup_list();
+	// Drop themes that are no longer inherited.
+	for (auto x = theme_index_cache.begin(); x != theme_index_cache.end();) {
+		if (find(lookup_list.begin(), lookup_list.end(), x->second.get()) == lookup_list.end())
+			x = theme_index_cache.erase(x);
+		else
+			++x;
 	}
 
+	return true;
+}
+
+auto theme_snapshot::watched_directories() const -> vector<string>
+{
+	// Themes referenced but not installed, to see them installed.
+	vector<string> missing{identifier, "hicolor"};
+	for (auto theme: lookup_list)
+		missing.insert(missing.end(), theme->inherits.begin(), theme->inherits.end());
+	for (auto theme: lookup_list)
+		missing.erase(remove(missing.begin(), missing.end(), theme->identifier), missing.end());
+
+	vector<string> ret{missing_directories};
+	for (auto & base: search_directories) {
+		ret.push_back(base);
+		for (auto & id: missing)
+			ret.push_back(base+"/"+id);
+		for (auto theme: lookup_list) {
+			string dir = base+"/"+theme->identifier;
+			ret.push_back(dir);
+			for (auto & subdir: theme->subdirs.names) {
+				// with parents of nested subdirs, to catch their creation.
+				for (auto p = subdir.find('/'); p != string::npos; p = subdir.find('/', p+1))
+					ret.push_back(dir+"/"+subdir.substr(0, p));
+				ret.push_back(dir+"/"+subdir);
+			}
+		}
+	}
+	sort(ret.begin(), ret.end());
+	ret.erase(unique(ret.begin(), ret.end()), ret.end());
+	return ret;
+}
+
+auto theme_snapshot::has_new_search_directory(vector<string> const & paths) const -> bool
+{
+	for (auto & path: paths) {
+		if (find(missing_directories.begin(), missing_directories.end(), path) != missing_directories.end())
+			return true;
+	}
+	return false;
 }
 
 // Implement XDG lookup
-string theme::_lookup_for_theme_index_file(string const & identifier) const
+string theme_snapshot::_lookup_for_theme_index_file(string const & identifier) const
 {
 	for (auto & p: search_directories) {
 		string f = p + "/" + identifier + "/index.theme";
-		cout << "lookup: " << f << endl;
+		stats_counters::add(stats->access_calls);
 		if (access(f.c_str(), R_OK) == 0) {
 			return f;
 		}
@@ -250,21 +916,35 @@ string theme::_lookup_for_theme_index_file(string const & identifier) const
 
 }
 
-theme_index const * theme::_get_theme_index(string const & identifier)
+theme_index const * theme_snapshot::_get_theme_index(string const & identifier)
 {
 	auto xtheme = theme_index_cache.find(identifier);
 	if (xtheme != theme_index_cache.end())
 		return xtheme->second.get();
 
+	auto t = _load_theme_index(identifier);
+	if (not t)
+		return nullptr;
+	if (not lazy)
+		t->set_icon_index(t->build_icon_index(search_directories));
+	theme_index_cache[identifier] = t;
+	return t.get();
+}
+
+shared_ptr<theme_index const> theme_snapshot::_load_theme_index(string const & identifier) const
+{
 	string filename = _lookup_for_theme_index_file(identifier);
 	if (filename == undef)
 		return nullptr;
 
-	auto & t = theme_index_cache[identifier] = unique_ptr<theme_index>{new theme_index()};
+	scoped_timer timer{stats->theme_load};
+	stats_counters::add(stats->themes_loaded);
+
+	shared_ptr<theme_index> t{new theme_index()};
 	t->identifier = identifier;
-	cout << "Load " << identifier << endl;
+	t->stats = stats;
 
-	desktop_file const data{filename, getenv_lang()};
+	mapped_desktop_file const data{filename, locale_matcher{getenv_lang()}, *stats};
 
 	auto icon_theme = data.find("Icon Theme");
 	if (icon_theme == data.end()) {
@@ -276,108 +956,413 @@ theme_index const * theme::_get_theme_index(string const & identifier)
 		cerr << "ERROR: Missing mandatory Directories entry" << endl;
 		return nullptr;
 	}
-	for (auto const & s: split(directories->second.data, ',')) {
+	vector<subdir_rule> rules;
+	for (auto const & s: split(mapped_group::unescape(directories->data), ',')) {
 		auto subdir = data.find(s);
 		if (subdir == data.end()) {
 			cerr << "ERROR: Missing mandatory subdir group `" << s << "'" << endl;
 			continue;
 		}
-		t->subdir_rules[s] = s_subdir_rule{subdir->second};
+		bool duplicate = false;
+		for (auto & r: rules) {
+			if (r.name == s) { duplicate = true; break; }
+		}
+		if (not duplicate)
+			rules.emplace_back(s, subdir->second);
 	}
+	auto n_rules = rules.size();
+	t->subdirs = subdir_table{std::move(rules)};
+	stats_counters::add(stats->invalid_entries, n_rules-t->subdirs.size());
 
 	auto inherits_iter = icon_theme->second.find("Inherits");
-	if (inherits_iter != icon_theme->second.end()) {
-		for(auto & parent_theme: split(inherits_iter->second.data, ',')) {
-			auto p = _get_theme_index(parent_theme);
-			if (p) {
-				t->inherits.push_back(p);
-			}
-		}
-	}
-	return t.get();
+	if (inherits_iter != icon_theme->second.end())
+		t->inherits = split(mapped_group::unescape(inherits_iter->data), ',');
+	return t;
 }
 
-string theme::find_icon(string const & name, int size, int scale) const
+string theme_snapshot::find_icon(string const & name, int size, int scale) const
 {
+	scoped_timer timer{stats->lookup};
 	string ret;
 	for (auto theme: lookup_list) {
 		ret = _lookup_icon_in_theme(*theme, name, size, scale);
 		if (ret != undef) {
+			stats_counters::add(stats->icons_found);
 			return ret;
 		}
 	}
-	return _lookup_fallback(name);
+	ret = _lookup_fallback(name);
+	stats_counters::add(ret != undef?stats->icons_found:stats->icons_missing);
+	return ret;
 }
 
-string theme::_lookup_fallback(string const & name) const
+auto theme_snapshot::find_icon_variants(string const & name) const -> vector<icon_variant>
 {
-	for (auto & basedir: search_directories) {
-		for (auto & e: extensions) {
-			string p = basedir+"/"+name+e;
-			if (access(p.c_str(), R_OK) == 0)
-				return p;
+	vector<icon_variant> ret;
+	for (auto theme: lookup_list) {
+		for (auto & l: theme->find_icon_locations(search_directories, name)) {
+			auto & subdirs = theme->subdirs;
+			ret.push_back(icon_variant{_make_path(*theme, l, name), theme->identifier,
+					extensions[l.extension], subdirs.types[l.subdir], subdirs.sizes[l.subdir],
+					subdirs.min_sizes[l.subdir], subdirs.max_sizes[l.subdir], subdirs.scales[l.subdir]});
 		}
 	}
-	return undef;
+
+	auto & fallback_icons = _get_fallback_icons();
+	auto x = fallback_icons.find(name);
+	if (x != fallback_icons.end())
+		ret.push_back(icon_variant{_lookup_fallback(name), string{}, extensions[x->second.second],
+				icon_variant::TYPE_UNTHEMED, 0, 0, 0, 0});
+	return ret;
 }
 
-auto theme::_build_lookup_list() -> void
+string theme_snapshot::_lookup_fallback(string const & name) const
 {
-	auto theme = lookup_list.back();
-	for (auto & p: theme->inherits) {
-		bool visited = false;
-		// CHeck if we already visited it
-		for (auto &v: lookup_list) {
-			if (v == p) { visited = true; break; }
+	auto & fallback_icons = _get_fallback_icons();
+	auto x = fallback_icons.find(name);
+	if (x == fallback_icons.end())
+		return undef;
+	auto & base = search_directories[x->second.first];
+	auto & ext = extensions[x->second.second];
+	string ret;
+	ret.reserve(base.size()+name.size()+ext.size()+1);
+	ret.append(base).append(1, '/').append(name).append(ext);
+	return ret;
+}
+
+auto theme_snapshot::_update_fallback(string const & name) -> void
+{
+	// Not built yet, the build will read the change.
+	if (not _fallback_ready)
+		return;
+	_fallback_icons.erase(name);
+	for (size_t b = 0; b < search_directories.size(); ++b) {
+		for (size_t e = 0; e < extensions.size(); ++e) {
+			string f = search_directories[b]+"/"+name+extensions[e];
+			stats_counters::add(stats->access_calls);
+			if (access(f.c_str(), F_OK) == 0) {
+				_fallback_icons[name] = {b, e};
+				return;
+			}
 		}
-		if (visited)
+	}
+}
+
+auto theme_snapshot::_get_fallback_icons() const -> unordered_map<string, pair<int, int>> const &
+{
+	if (_fallback_ready.load(memory_order_acquire))
+		return _fallback_icons;
+	lock_guard<mutex> l{_fallback_lock};
+	if (not _fallback_ready.load(memory_order_relaxed)) {
+		_build_fallback_index();
+		_fallback_ready.store(true, memory_order_release);
+	}
+	return _fallback_icons;
+}
+
+auto theme_snapshot::_build_fallback_index() const -> void
+{
+	string name;
+	for (size_t b = 0; b < search_directories.size(); ++b) {
+		stats_counters::add(stats->directories_read);
+		DIR * dir = opendir(search_directories[b].c_str());
+		if (dir == nullptr)
 			continue;
-		lookup_list.push_back(p);
-		_build_lookup_list();
+		struct dirent * p;
+		while((p = readdir(dir)) != nullptr) {
+			if (p->d_name[0] == '.')
+				continue;
+			int e = icon_extension(p->d_name, name);
+			if (e < 0)
+				continue;
+			// keep the first basedir, then the first extension.
+			auto x = _fallback_icons.insert({name, {b, e}});
+			if (not x.second and x.first->second.first == static_cast<int>(b)
+					and x.first->second.second > e)
+				x.first->second.second = e;
+		}
+		closedir(dir);
 	}
 }
 
+auto theme_snapshot::_build_lookup_list() -> void
+{
+	lookup_list.clear();
+	_append_lookup_list(identifier);
+	_append_lookup_list("hicolor");
+}
+
+auto theme_snapshot::_append_lookup_list(string const & identifier) -> void
+{
+	auto theme = _get_theme_index(identifier);
+	if (theme == nullptr)
+		return;
+	// Check if we already visited it
+	if (find(lookup_list.begin(), lookup_list.end(), theme) != lookup_list.end())
+		return;
+	lookup_list.push_back(theme);
+	for (auto & p: theme->inherits)
+		_append_lookup_list(p);
+}
+
 
 // Implement XDG lookup
-string theme::_lookup_icon_in_theme(theme_index const & theme, string const & name, int size, int scale) const
+string theme_snapshot::_lookup_icon_in_theme(theme_index const & theme, string const & name, int size, int scale) const
 {
-	// First pass exact match
-	for (auto & subdir: theme.subdir_rules) {
-		if (subdir.second.match(size, scale)) {
-			for (auto & basedir: search_directories) {
-				for (auto & ext: extensions) {
-					string p = basedir+"/"+theme.identifier+"/"+subdir.first+"/"+name+ext;
-//					cout << p << endl;
-					if (access(p.c_str(), R_OK) == 0)
-						return p;
+	auto locations = theme.find_icon_locations(search_directories, name);
+	if (locations.empty())
+		return undef;
+
+	auto match = select_icon_location(locations,
+		[&](theme_index::icon_location const & l) {
+			return theme.subdirs.match(l.subdir, size, scale);
+		},
+		[&](theme_index::icon_location const & l) {
+			return theme.subdirs.dist(l.subdir, size, scale);
+		});
+
+	if (match)
+		return _make_path(theme, *match, name);
+	return undef;
+}
+
+auto theme_snapshot::find_icons(vector<icon_request> const & requests, vector<size_t> const & todo, vector<string> & results) const -> void
+{
+	// Distinct (size, scale) of the batch, usually only a few.
+	vector<pair<int, int>> sizes;
+	vector<size_t> size_of(requests.size());
+	// Requests grouped by name, thus locations are looked up once per name.
+	unordered_map<string_view, vector<size_t>> names;
+	names.reserve(todo.size());
+	for (auto i: todo) {
+		auto sz = make_pair(requests[i].size, requests[i].scale);
+		auto x = find(sizes.begin(), sizes.end(), sz);
+		size_of[i] = x - sizes.begin();
+		if (x == sizes.end())
+			sizes.push_back(sz);
+		names[string_view{requests[i].name}].push_back(i);
+	}
+
+	// Match and distance of every subdir for every size, computed once per
+	// theme for the whole batch.
+	struct size_table {
+		bool ready;
+		size_t stride;
+		vector<char> match;
+		vector<int> dist;
+	};
+	vector<size_table> tables(lookup_list.size(), size_table{false, 0, {}, {}});
+
+	auto get_table = [&](size_t t) -> size_table const & {
+		auto & table = tables[t];
+		if (not table.ready) {
+			auto & subdirs = lookup_list[t]->subdirs;
+			table.stride = subdirs.size();
+			table.match.resize(subdirs.size()*sizes.size());
+			table.dist.resize(subdirs.size()*sizes.size());
+			for (size_t k = 0; k < sizes.size(); ++k)
+				subdirs.evaluate(sizes[k].first, sizes[k].second,
+						table.match.data()+k*table.stride, table.dist.data()+k*table.stride);
+			table.ready = true;
+		}
+		return table;
+	};
+
+	vector<string> paths;
+	vector<size_t> pending;
+	for (auto & x: names) {
+		auto & name = requests[x.second.front()].name;
+		pending = x.second;
+		for (size_t t = 0; t < lookup_list.size() and not pending.empty(); ++t) {
+			auto & theme = *lookup_list[t];
+			auto locations = theme.find_icon_locations(search_directories, name);
+			if (locations.empty())
+				continue;
+			auto & table = get_table(t);
+			// Many sizes end up on the same file, build each path once.
+			paths.assign(locations.size(), string{});
+			// As in find_icon, requests without a usable subdir go on with the next theme.
+			size_t left = 0;
+			for (auto i: pending) {
+				size_t k = size_of[i];
+				auto match = select_icon_location(locations,
+					[&](theme_index::icon_location const & l) -> bool {
+						return table.match[k*table.stride+l.subdir];
+					},
+					[&](theme_index::icon_location const & l) {
+						return table.dist[k*table.stride+l.subdir];
+					});
+				if (not match) {
+					pending[left++] = i;
+					continue;
 				}
+				auto & path = paths[match-locations.begin()];
+				if (path.empty())
+					path = _make_path(theme, *match, name);
+				results[i] = path;
 			}
+			pending.resize(left);
 		}
+
+		size_t missing = 0;
+		if (not pending.empty()) {
+			string fallback = _lookup_fallback(name);
+			for (auto i: pending)
+				results[i] = fallback;
+			if (fallback == undef)
+				missing = pending.size();
+		}
+
+		stats_counters::add(stats->icons_found, x.second.size()-missing);
+		stats_counters::add(stats->icons_missing, missing);
 	}
+}
 
-	// Second pass best match
-	int subdir_distance = std::numeric_limits<int>::max();
-	string match;
-	for (auto & subdir: theme.subdir_rules) {
-		if (subdir.second.match(size, scale)) {
-			int d = subdir.second.dist(size, scale);
-			if (d > subdir_distance)
-				continue;
-			for (auto & basedir: search_directories) {
-				for (auto & ext: extensions) {
-					string p = basedir+"/"+theme.identifier+"/"+subdir.first+"/"+name+ext;
-					if (access(p.c_str(), R_OK) == 0) {
-						subdir_distance = d;
-						match = p;
-					}
-				}
+icon_size_table::icon_size_table(vector<icon_variant> variants) :
+	_variants{std::move(variants)}
+{
+	if (_variants.empty())
+		return;
+
+	int64_t const int_min = numeric_limits<int>::min();
+	int64_t const int_max = numeric_limits<int>::max();
+
+	// Append a segment, merged with the previous one if they have the same result.
+	auto append = [](vector<segment> & segments, int64_t begin, int variant) {
+		if (segments.empty() or segments.back().variant != variant)
+			segments.push_back(segment{static_cast<int>(begin), variant});
+	};
+
+	// Sorted points within the int range, starting with its minimum.
+	auto sorted_points = [&](vector<int64_t> & points) {
+		points.push_back(int_min);
+		sort(points.begin(), points.end());
+		points.erase(unique(points.begin(), points.end()), points.end());
+		points.erase(remove_if(points.begin(), points.end(), [&](int64_t p) {
+			return p < int_min or p > int_max;
+		}), points.end());
+	};
+
+	// Unthemed icons are only used when no theme has the icon.
+	if (_variants[0].type == icon_variant::TYPE_UNTHEMED) {
+		_closest.push_back(segment{numeric_limits<int>::min(), 0});
+		return;
+	}
+
+	// Only the first theme with the icon is used by find_icon.
+	int n = 0;
+	while (n < static_cast<int>(_variants.size()) and _variants[n].theme == _variants[0].theme)
+		++n;
+
+	// First pass of find_icon: first variant of the scale whose range has the size.
+	vector<int> scales;
+	for (int i = 0; i < n; ++i)
+		scales.push_back(_variants[i].scale);
+	sort(scales.begin(), scales.end());
+	scales.erase(unique(scales.begin(), scales.end()), scales.end());
+	for (auto scale: scales) {
+		vector<int64_t> points;
+		for (int i = 0; i < n; ++i) {
+			if (_variants[i].scale == scale) {
+				points.push_back(_variants[i].min_size);
+				points.push_back(int64_t{_variants[i].max_size}+1);
 			}
 		}
+		sorted_points(points);
+
+		vector<segment> segments;
+		for (auto p: points) {
+			int found = -1;
+			for (int i = 0; i < n and found < 0; ++i) {
+				auto & v = _variants[i];
+				if (v.scale == scale and v.min_size <= p and p <= v.max_size)
+					found = i;
+			}
+			append(segments, p, found);
+		}
+		_exact.emplace_back(scale, std::move(segments));
 	}
 
-	if (match != undef)
-		return match;
-	return undef;
+	/**
+	 * Second pass: first variant with the smallest distance to size*scale.
+	 * Distances are piecewise linear, between two ends of ranges the
+	 * closest variant is either the range with the highest end below or
+	 * the range with the lowest start above, it changes where their
+	 * distances cross.
+	 **/
+	vector<int64_t> lo(n);
+	vector<int64_t> hi(n);
+	vector<int64_t> points;
+	for (int i = 0; i < n; ++i) {
+		lo[i] = int64_t{_variants[i].min_size}*_variants[i].scale;
+		hi[i] = int64_t{_variants[i].max_size}*_variants[i].scale;
+		for (auto p: {lo[i], lo[i]+1, hi[i], hi[i]+1})
+			points.push_back(p);
+	}
+	sort(points.begin(), points.end());
+	points.erase(unique(points.begin(), points.end()), points.end());
+
+	size_t ends = points.size();
+	for (size_t k = 0; k+1 < ends; ++k) {
+		int64_t below = numeric_limits<int64_t>::min();
+		int64_t above = numeric_limits<int64_t>::max();
+		for (int i = 0; i < n; ++i) {
+			if (hi[i] < points[k])
+				below = max(below, hi[i]);
+			if (lo[i] > points[k])
+				above = min(above, lo[i]);
+		}
+		if (below == numeric_limits<int64_t>::min() or above == numeric_limits<int64_t>::max())
+			continue;
+		// floor of the middle, for negative values too.
+		int64_t sum = below+above;
+		int64_t middle = sum >= 0?sum/2:-((-sum+1)/2);
+		points.push_back(middle);
+		points.push_back(middle+1);
+	}
+	sorted_points(points);
+
+	for (auto x: points) {
+		int found = -1;
+		int64_t best = numeric_limits<int64_t>::max();
+		for (int i = 0; i < n; ++i) {
+			int64_t d = max<int64_t>(lo[i]-x, 0)+max<int64_t>(x-hi[i], 0);
+			if (d < best) {
+				best = d;
+				found = i;
+			}
+		}
+		append(_closest, x, found);
+	}
+}
+
+auto icon_size_table::_find(vector<segment> const & segments, int x) -> int
+{
+	// Last segment starting at or before x, the first one starts at INT_MIN.
+	auto s = upper_bound(segments.begin(), segments.end(), x, [](int x, segment const & s) {
+		return x < s.begin;
+	});
+	return (s-1)->variant;
+}
+
+auto icon_size_table::lookup(int size, int scale) const -> string const &
+{
+	if (_variants.empty())
+		return undef;
+
+	auto exact = lower_bound(_exact.begin(), _exact.end(), scale,
+			[](pair<int, vector<segment>> const & x, int scale) {
+		return x.first < scale;
+	});
+	if (exact != _exact.end() and exact->first == scale) {
+		int v = _find(exact->second, size);
+		if (v >= 0)
+			return _variants[v].path;
+	}
+
+	int64_t x = int64_t{size}*scale;
+	x = min<int64_t>(max<int64_t>(x, numeric_limits<int>::min()), numeric_limits<int>::max());
+	return _variants[_find(_closest, static_cast<int>(x))].path;
 }
 
 } // namespace xdg
@@ -27,29 +27,258 @@ along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
 #include <array>
 #include <unordered_map>
 #include <string>
+#include <mutex>
+#include <atomic>
+#include <list>
+#include <cstdint>
+
+#include "xdg-utils.hxx"
+#include "xdg-stats.hxx"
 
 namespace xdg {
 
 struct theme_index;
+struct theme_snapshot;
+struct stats_counters;
+
+struct icon_request {
+	std::string name;
+	int size;
+	int scale;
+};
+
+/**
+ * One file of an icon, as returned by theme::find_icon_variants. size,
+ * min_size and max_size come from the subdir rule, in unscaled pixels.
+ * An unthemed icon, found directly within a base directory, has an empty
+ * theme, the TYPE_UNTHEMED type and all sizes set to 0.
+ **/
+struct icon_variant {
+	enum : uint8_t {
+		TYPE_UNTHEMED  = 0,
+		TYPE_THRESHOLD = 1,
+		TYPE_FIXED     = 2,
+		TYPE_SCALABLE  = 3
+	};
+
+	std::string path;
+	std::string theme;     //< identifier of the theme providing it.
+	std::string extension; //< ".png", ".svg" or ".xpm".
+	uint8_t type;
+	int size;
+	int min_size;
+	int max_size;
+	int scale;
+};
+
+/**
+ * All sizes of one icon resolved ahead of time from its variants: lookup
+ * returns the same path as theme::find_icon with a binary search, without
+ * any access to the theme. The table is a copy, it does not follow
+ * updates of the theme.
+ **/
+class icon_size_table {
+
+	// From begin to the next segment, variant is the result or -1.
+	struct segment {
+		int begin;
+		int variant;
+	};
+
+	std::vector<icon_variant> _variants;
+	// Exact matches for each scale of the variants, sorted by scale.
+	std::vector<std::pair<int, std::vector<segment>>> _exact;
+	// Closest variant for each size*scale.
+	std::vector<segment> _closest;
+
+	static auto _find(std::vector<segment> const & segments, int x) -> int;
+
+public:
+
+	icon_size_table() = default;
 
+	// variants in the order of theme::find_icon_variants.
+	icon_size_table(std::vector<icon_variant> variants);
+
+	auto variants() const -> std::vector<icon_variant> const & { return _variants; }
+
+	// Same as theme::find_icon for this icon, undef if there is no variant.
+	auto lookup(int size, int scale) const -> std::string const &;
+
+};
+
+/**
+ * Icon theme lookup, once built a theme is read-only and find_icon can be
+ * called from several threads at once. Lookups run on an immutable
+ * snapshot of the theme indexes, results are cached in independently
+ * locked shards thus concurrent readers rarely contend.
+ **/
 class theme {
+
+	/**
+	 * Key of a cached result. Looked up with a view of the requested
+	 * name, thus a hit does not allocate, stored with a view of the name
+	 * owned by the cache entry.
+	 **/
+	struct _cache_key {
+		string_view name;
+		int size;
+		int scale;
+
+		bool operator==(_cache_key const & x) const
+		{
+			return size == x.size and scale == x.scale and name == x.name;
+		}
+	};
+
+	struct _cache_key_hash {
+		size_t operator()(_cache_key const & k) const
+		{
+			size_t h = std::hash<string_view>{}(k.name);
+			h ^= std::hash<int>{}(k.size)+0x9e3779b9u+(h << 6)+(h >> 2);
+			h ^= std::hash<int>{}(k.scale)+0x9e3779b9u+(h << 6)+(h >> 2);
+			return h;
+		}
+	};
+
+	/**
+	 * LRU of find_icon results, undef results are cached too. All sizes of
+	 * an icon name are in the same shard.
+	 **/
+	struct _cache_shard {
+		struct entry {
+			std::string name;
+			int size;
+			int scale;
+			std::string value;
+		};
+
+		std::mutex lock;
+		uint64_t generation; //< snapshot generation of the cached results.
+		size_t capacity;
+		std::list<entry> lru; //< most recently used first, never moved.
+		std::unordered_map<_cache_key, std::list<entry>::iterator, _cache_key_hash> results;
+
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t evictions;
+
+		_cache_shard() : generation{0}, capacity{0}, hits{0}, misses{0}, evictions{0} { }
+
+		void clear()
+		{
+			lru.clear();
+			results.clear();
+		}
+
+	};
+
 	std::string identifier;
-	std::vector<std::string> search_directories;
-	std::unordered_map<std::string, std::unique_ptr<theme_index>> theme_index_cache;
-	std::vector<theme_index const *> lookup_list;
+	bool _lazy;
+	std::shared_ptr<stats_counters> _stats; //< shared with the snapshots.
+	std::shared_ptr<theme_snapshot const> _snapshot; //< only accessed atomically.
 
-	auto _get_theme_index(std::string const & identifier) -> theme_index const *;
-	auto _lookup_for_theme_index_file(std::string const & identifier) const -> std::string;
-	auto _build_lookup_list() -> void;
-	auto _lookup_icon_in_theme(theme_index const & theme, std::string const & name, int size, int scale) const -> std::string;
-	auto _lookup_fallback(std::string const & name) const -> std::string;
+	// Locks and atomics, behind a pointer thus the theme stays movable.
+	struct _locked_state {
+		std::array<_cache_shard, 16> cache;
+		std::atomic<size_t> cache_capacity; //< read by concurrent lookups.
+		std::mutex update_lock; //< serialize snapshot updates.
+
+		_locked_state() : cache_capacity{0} { }
+	};
+	std::unique_ptr<_locked_state> _state;
+
+	auto _get_snapshot() const -> std::shared_ptr<theme_snapshot const>;
+	auto _set_snapshot(std::shared_ptr<theme_snapshot const> const & snapshot) -> void;
+	auto _get_cache_shard(std::string const & name) const -> _cache_shard &;
+	static auto _cache_insert(_cache_shard & shard, uint64_t generation, _cache_key const & key, std::string const & value) -> void;
+	static auto _cache_evict(_cache_shard & shard, std::list<_cache_shard::entry>::iterator x) -> std::list<_cache_shard::entry>::iterator;
 
 public:
+
+	struct cache_stats {
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t evictions;
+		size_t size;
+		size_t capacity;
+	};
+
+	static size_t const default_cache_capacity = 4096;
+
+	// When the directories of the themes are read.
+	enum loading : uint8_t {
+		eager, //< all of them by the constructor.
+		lazy   //< those of a theme by the first lookup that reach it.
+	};
+
 	~theme();
-	theme(std::string const & identifier);
+
+	/**
+	 * Load the theme and the themes it inherits. In lazy mode only the
+	 * index.theme files are read to know the lookup order, the directories
+	 * of a theme are read the first time a lookup reach it, thus themes
+	 * after the one that provide an icon are never read. index.theme files
+	 * are still parsed whole, and all subdirs of a theme are read at once.
+	 **/
+	theme(std::string const & identifier, size_t cache_capacity = default_cache_capacity, loading mode = eager);
+
+	// A moved from theme can only be destroyed or assigned to.
+	theme(theme &&) = default;
+	theme & operator=(theme &&) = default;
+
 	// find request icon within the theme, return undef on fail.
 	auto find_icon(std::string const & name, int size, int scale) const -> std::string;
 
+	/**
+	 * Same as find_icon for each request, but the batch share the work:
+	 * each icon name is looked up once for all its sizes and subdir rules
+	 * are evaluated once per theme for the whole batch.
+	 **/
+	auto find_icons(std::vector<icon_request> const & requests) const -> std::vector<std::string>;
+
+	/**
+	 * Every file of the icon name, for each theme of the lookup order
+	 * then the unthemed one, each theme in the order used by find_icon.
+	 * Results are not cached.
+	 **/
+	auto find_icon_variants(std::string const & name) const -> std::vector<icon_variant>;
+
+	// Table of all sizes of the icon name, see icon_size_table.
+	auto icon_sizes(std::string const & name) const -> icon_size_table;
+
+	// Same as find_icon but bypass the result cache.
+	auto find_icon_uncached(std::string const & name, int size, int scale) const -> std::string;
+
+	// Drop all cached results, or only those of one icon name.
+	auto invalidate_cache() const -> void;
+	auto invalidate_cache(std::string const & name) const -> void;
+
+	// Change the maximum number of cached results, 0 disable the cache.
+	auto set_cache_capacity(size_t capacity) -> void;
+
+	auto get_cache_stats() const -> cache_stats;
+
+	// Work done by this theme, including cache hits and misses.
+	auto get_stats() const -> stats;
+
+	// Reset get_stats and the counters of get_cache_stats.
+	auto reset_stats() const -> void;
+
+	/**
+	 * Apply the changes of files or directories in paths, usually reported
+	 * by a watcher: only affected index.theme files and subdirs are read
+	 * again. Return false if none of the paths belong to the theme. Running
+	 * lookups keep using the previous snapshot.
+	 **/
+	auto update(std::vector<std::string> const & paths) -> bool;
+
+	// Build the theme again from scratch.
+	auto reload() -> void;
+
+	// Directories to watch to keep the theme up to date, some may not exist.
+	auto watched_directories() const -> std::vector<std::string>;
+
 };
 
 } // namespace xdg
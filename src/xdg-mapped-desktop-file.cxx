@@ -0,0 +1,232 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "xdg-utils.hxx"
+
+#include "xdg-desktop-file.hxx"
+#include "xdg-mapped-desktop-file.hxx"
+#include "xdg-desktop-file-parser.hxx"
+#include "xdg-application-scan.hxx"
+#include "xdg-batch-read.hxx"
+#include "xdg-stats-counters.hxx"
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+namespace xdg {
+
+using namespace std;
+
+mapped_desktop_file::mapping::mapping(string const & filename) :
+	data{nullptr},
+	size{0}
+{
+	int fd = open(filename.c_str(), O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 and st.st_size > 0) {
+		void * p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			data = static_cast<char const *>(p);
+			size = st.st_size;
+		}
+	}
+
+	close(fd);
+}
+
+shared_ptr<mapped_desktop_file::mapping const> mapped_desktop_file::mapping::from_contents(string && contents)
+{
+	shared_ptr<mapping> ret{new mapping};
+	ret->_contents = std::move(contents);
+	if (not ret->_contents.empty()) {
+		ret->data = ret->_contents.data();
+		ret->size = ret->_contents.size();
+	}
+	return ret;
+}
+
+mapped_desktop_file::mapping::~mapping()
+{
+	if (data and _contents.empty())
+		munmap(const_cast<char *>(data), size);
+}
+
+ostream & operator<<(ostream & out, mapped_desktop_file const & data)
+{
+	for (auto & g : data) {
+		out << "[" << g.first.to_string() << "]" << endl;
+		for (auto & e: g.second) {
+			out << e.key.to_string() << "=" << e.data.to_string() << endl;
+		}
+	}
+	return out;
+}
+
+string mapped_group::unescape(string_view const & s)
+{
+	return group::convert<string>(s);
+}
+
+namespace {
+
+struct mapped_desktop_file_builder {
+	mapped_desktop_file & file;
+	locale_matcher const & lang;
+	mapped_group * cur_group;
+	// Entries of cur_group are gathered here, then copied at once.
+	vector<mapped_entry> & entries;
+	uint64_t invalid_lines;
+
+	// The buffer is reused by all files parsed by a thread.
+	static vector<mapped_entry> & entries_buffer()
+	{
+		static thread_local vector<mapped_entry> buffer;
+		return buffer;
+	}
+
+	mapped_desktop_file_builder(mapped_desktop_file & file, locale_matcher const & lang) :
+		file(file), lang(lang), cur_group{nullptr}, entries(entries_buffer()), invalid_lines{0} { }
+
+	void flush()
+	{
+		if (cur_group)
+			cur_group->assign(entries.begin(), entries.end());
+	}
+
+	void group(string_view const & name)
+	{
+		flush();
+		cur_group = &file[name];
+		entries.assign(cur_group->begin(), cur_group->end());
+	}
+
+	void entry(string_view const & key, string_view const & locale, bool localized, string_view const & value)
+	{
+		if (cur_group == nullptr)
+			return;
+
+		// If no language is defined, score 0 but mach any LANG.
+		int32_t score = 0;
+		if (localized)
+			score = lang.score(locale);
+
+		if (score < 0)
+			return;
+
+		for (auto & e: entries) {
+			if (e.key == key) {
+				if (e.score < score) {
+					e.score = score;
+					e.data = value;
+				}
+				return;
+			}
+		}
+
+		entries.push_back(mapped_entry{score, key, value});
+	}
+
+	void invalid(string_view const &)
+	{
+		invalid_lines += 1;
+	}
+
+};
+
+} // anonymous namespace
+
+mapped_desktop_file::mapped_desktop_file(string const & filename, string const & lang) :
+	mapped_desktop_file{filename, locale_matcher{lang}}
+{
+
+}
+
+mapped_desktop_file::mapped_desktop_file(string const & filename, locale_matcher const & locale) :
+	mapped_desktop_file{filename, locale, application_stats()}
+{
+
+}
+
+mapped_desktop_file::mapped_desktop_file(string const & filename, locale_matcher const & locale, stats_counters & stats) :
+	filename{filename},
+	_mapping{make_shared<mapping>(filename)}
+{
+	_parse(locale, stats);
+}
+
+mapped_desktop_file::mapped_desktop_file(string const & filename, string && contents, locale_matcher const & locale) :
+	filename{filename},
+	_mapping{mapping::from_contents(std::move(contents))}
+{
+	_parse(locale, application_stats());
+}
+
+void mapped_desktop_file::_parse(locale_matcher const & locale, stats_counters & stats)
+{
+	scoped_timer timer{stats.parse};
+	mapped_desktop_file_builder builder{*this, locale};
+	parse_desktop_file(_mapping->data, _mapping->data+_mapping->size, builder);
+	builder.flush();
+
+	stats_counters::add(stats.files_parsed);
+	stats_counters::add(stats.bytes_read, _mapping->size);
+	stats_counters::add(stats.invalid_entries, builder.invalid_lines);
+}
+
+mapped_desktop_file::mapped_desktop_file(string const & filename, shared_ptr<mapping const> const & m) :
+	filename{filename},
+	_mapping{m}
+{
+
+}
+
+vector<mapped_desktop_file> mapped_desktop_file::list_all_applications(string const & lang)
+{
+	scoped_timer timer{application_stats().scan};
+	scoped_allocation_account account{application_stats().allocations};
+	vector<mapped_desktop_file> list;
+	auto files = desktop_file::list_all_application_files();
+	list.reserve(files.size());
+	locale_matcher const locale{lang};
+	batch_reader{}.for_each(files, [&](string const & path, string && contents) {
+		list.emplace_back(path, std::move(contents), locale);
+	});
+	return list;
+}
+
+vector<mapped_desktop_file> mapped_desktop_file::list_all_applications(string const & lang, unsigned nthreads)
+{
+	if (nthreads == 1)
+		return list_all_applications(lang);
+	scoped_timer timer{application_stats().scan};
+	scoped_allocation_account account{application_stats().allocations};
+	return application_scan<mapped_desktop_file>{locale_matcher{lang}}.run(nthreads);
+}
+
+} // namespace xdg
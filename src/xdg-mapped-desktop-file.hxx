@@ -0,0 +1,143 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SRC_XDG_MAPPED_DESKTOP_FILE_HXX_
+#define SRC_XDG_MAPPED_DESKTOP_FILE_HXX_
+
+#include <unordered_map>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <stdexcept>
+#include <cstdint>
+#include <vector>
+#include <memory>
+
+#include "xdg-utils.hxx"
+#include "xdg-desktop-file.hxx"
+
+namespace xdg {
+
+struct stats_counters;
+
+struct mapped_entry {
+	int32_t score; //< keep language score.
+	string_view key;
+	string_view data; //< raw value, still escaped.
+};
+
+/**
+ * Read-only group of a mapped_desktop_file, keys and values are slices of
+ * the mapped file. Groups are small thus entries are looked up linearly.
+ **/
+struct mapped_group : public std::vector<mapped_entry>
+{
+	// Unescape \s, \n, \t, \r and \\ as defined by the desktop entry spec.
+	static std::string unescape(string_view const & s);
+
+	const_iterator find(string_view const & key) const
+	{
+		for (auto x = begin(); x != end(); ++x) {
+			if (x->key == key)
+				return x;
+		}
+		return end();
+	}
+
+	// Same as group::getattr.
+	template<typename T>
+	T getattr(string_view const & key) const
+	{
+		auto x = this->find(key);
+		if (x == this->end())
+			throw std::runtime_error("Key not available");
+		return group::convert<T>(x->data);
+	}
+
+	template<typename T>
+	T getattr(string_view const & key, T const & default_value) const
+	{
+		auto x = this->find(key);
+		if (x == this->end())
+			return default_value;
+		return group::convert<T>(x->data);
+	}
+
+};
+
+/**
+ * Read-only alternative to desktop_file, the file is mmaped and groups,
+ * keys and values are kept as string_view into the mapping.
+ **/
+struct mapped_desktop_file : public std::unordered_map<string_view, mapped_group>
+{
+	// Read-only mmap of a whole file, data is nullptr if the file is empty or missing.
+	struct mapping {
+		char const * data;
+		size_t size;
+
+		mapping(std::string const & filename);
+		~mapping();
+
+		// Keep contents already read instead of a mapping.
+		static std::shared_ptr<mapping const> from_contents(std::string && contents);
+
+		mapping(mapping const &) = delete;
+		mapping & operator=(mapping const &) = delete;
+
+	private:
+		std::string _contents;
+
+		mapping() : data{nullptr}, size{0} { }
+	};
+
+	std::string filename;
+
+private:
+	std::shared_ptr<mapping const> _mapping;
+
+	void _parse(locale_matcher const & locale, stats_counters & stats);
+
+public:
+	friend std::ostream & operator<<(std::ostream & out, mapped_desktop_file const & file);
+
+	mapped_desktop_file(std::string const & filename, std::string const & lang);
+
+	// Same as above, with a matcher built once for many files.
+	mapped_desktop_file(std::string const & filename, locale_matcher const & locale);
+
+	// Same as above, the parse is accounted in stats instead of get_application_stats.
+	mapped_desktop_file(std::string const & filename, locale_matcher const & locale, stats_counters & stats);
+
+	// Same as above, parse contents already read from filename.
+	mapped_desktop_file(std::string const & filename, std::string && contents, locale_matcher const & locale);
+
+	// Empty file that keep m alive, the caller fill groups with slices of m.
+	mapped_desktop_file(std::string const & filename, std::shared_ptr<mapping const> const & m);
+
+	static std::vector<mapped_desktop_file> list_all_applications(std::string const & lang);
+	static std::vector<mapped_desktop_file> list_all_applications(std::string const & lang, unsigned nthreads);
+
+};
+
+} // namespace xdg
+
+#endif /* SRC_XDG_MAPPED_DESKTOP_FILE_HXX_ */
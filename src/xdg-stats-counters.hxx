@@ -0,0 +1,172 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef SRC_XDG_STATS_COUNTERS_HXX_
+#define SRC_XDG_STATS_COUNTERS_HXX_
+
+#include <atomic>
+#include <chrono>
+
+#include "xdg-stats.hxx"
+#include "xdg-allocation.hxx"
+
+namespace xdg {
+
+// Concurrent side of latency_histogram.
+struct latency_counter {
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> total_ns;
+	std::array<std::atomic<uint64_t>, latency_histogram::bucket_count> buckets;
+
+	latency_counter() { reset(); }
+
+	void add(uint64_t ns)
+	{
+		size_t i = 0;
+		while (i+1 < buckets.size() and (ns >> (i+1)) != 0)
+			++i;
+		count.fetch_add(1, std::memory_order_relaxed);
+		total_ns.fetch_add(ns, std::memory_order_relaxed);
+		buckets[i].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	latency_histogram get() const
+	{
+		latency_histogram ret;
+		ret.count = count.load(std::memory_order_relaxed);
+		ret.total_ns = total_ns.load(std::memory_order_relaxed);
+		for (size_t i = 0; i < buckets.size(); ++i)
+			ret.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+		return ret;
+	}
+
+	void reset()
+	{
+		count = 0;
+		total_ns = 0;
+		for (auto & b: buckets)
+			b = 0;
+	}
+
+};
+
+// Concurrent side of stats, updated with relaxed increments.
+struct stats_counters {
+	std::atomic<uint64_t> files_parsed;
+	std::atomic<uint64_t> bytes_read;
+	std::atomic<uint64_t> invalid_entries;
+	std::atomic<uint64_t> directories_read;
+	std::atomic<uint64_t> access_calls;
+	std::atomic<uint64_t> stat_calls;
+	std::atomic<uint64_t> themes_loaded;
+	std::atomic<uint64_t> icons_found;
+	std::atomic<uint64_t> icons_missing;
+
+	latency_counter parse;
+	latency_counter theme_load;
+	latency_counter index_build;
+	latency_counter lookup;
+	latency_counter scan;
+
+	allocation_account * allocations;
+
+	stats_counters() : allocations{allocation_account::create()} { reset(); }
+	~stats_counters() { allocations->release(); }
+
+	stats_counters(stats_counters const &) = delete;
+	stats_counters & operator=(stats_counters const &) = delete;
+
+	static void add(std::atomic<uint64_t> & counter, uint64_t n = 1)
+	{
+		counter.fetch_add(n, std::memory_order_relaxed);
+	}
+
+	// Cache counters are not kept here, see theme::get_stats.
+	stats get() const
+	{
+		stats ret;
+		ret.files_parsed = files_parsed.load(std::memory_order_relaxed);
+		ret.bytes_read = bytes_read.load(std::memory_order_relaxed);
+		ret.invalid_entries = invalid_entries.load(std::memory_order_relaxed);
+		ret.directories_read = directories_read.load(std::memory_order_relaxed);
+		ret.access_calls = access_calls.load(std::memory_order_relaxed);
+		ret.stat_calls = stat_calls.load(std::memory_order_relaxed);
+		ret.themes_loaded = themes_loaded.load(std::memory_order_relaxed);
+		ret.icons_found = icons_found.load(std::memory_order_relaxed);
+		ret.icons_missing = icons_missing.load(std::memory_order_relaxed);
+		ret.cache_hits = 0;
+		ret.cache_misses = 0;
+		ret.parse = parse.get();
+		ret.theme_load = theme_load.get();
+		ret.index_build = index_build.get();
+		ret.lookup = lookup.get();
+		ret.scan = scan.get();
+		ret.allocations = allocations->get();
+		return ret;
+	}
+
+	void reset()
+	{
+		files_parsed = 0;
+		bytes_read = 0;
+		invalid_entries = 0;
+		directories_read = 0;
+		access_calls = 0;
+		stat_calls = 0;
+		themes_loaded = 0;
+		icons_found = 0;
+		icons_missing = 0;
+		parse.reset();
+		theme_load.reset();
+		index_build.reset();
+		lookup.reset();
+		scan.reset();
+		allocations->reset();
+	}
+
+};
+
+// Add the time elapsed since its creation to a latency_counter.
+class scoped_timer {
+	latency_counter & _counter;
+	std::chrono::steady_clock::time_point _start;
+
+public:
+	scoped_timer(latency_counter & counter) :
+		_counter(counter), _start{std::chrono::steady_clock::now()} { }
+
+	~scoped_timer()
+	{
+		auto d = std::chrono::steady_clock::now()-_start;
+		_counter.add(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+	}
+
+	scoped_timer(scoped_timer const &) = delete;
+	scoped_timer & operator=(scoped_timer const &) = delete;
+};
+
+// Counters behind get_application_stats.
+stats_counters & application_stats();
+
+} // namespace xdg
+
+#endif /* SRC_XDG_STATS_COUNTERS_HXX_ */
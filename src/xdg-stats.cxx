@@ -0,0 +1,44 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "xdg-stats.hxx"
+#include "xdg-stats-counters.hxx"
+
+namespace xdg {
+
+stats_counters & application_stats()
+{
+	static stats_counters counters;
+	return counters;
+}
+
+stats get_application_stats()
+{
+	return application_stats().get();
+}
+
+void reset_application_stats()
+{
+	application_stats().reset();
+}
+
+} // namespace xdg
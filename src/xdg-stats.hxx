@@ -0,0 +1,120 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef SRC_XDG_STATS_HXX_
+#define SRC_XDG_STATS_HXX_
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+namespace xdg {
+
+/**
+ * Latency histogram, bucket i count the samples that took between 2^i
+ * and 2^(i+1) nanoseconds, the last bucket count all longer samples.
+ **/
+struct latency_histogram {
+	static std::size_t const bucket_count = 32;
+
+	uint64_t count;
+	uint64_t total_ns;
+	std::array<uint64_t, bucket_count> buckets;
+
+	double mean_ns() const
+	{
+		return count?static_cast<double>(total_ns)/count:0.0;
+	}
+
+	// Upper bound in nanoseconds of the bucket holding the q quantile.
+	uint64_t quantile_ns(double q) const
+	{
+		uint64_t rank = static_cast<uint64_t>(q*count);
+		uint64_t seen = 0;
+		for (std::size_t i = 0; i < bucket_count; ++i) {
+			seen += buckets[i];
+			if (seen > rank)
+				return uint64_t{2} << i;
+		}
+		return 0;
+	}
+
+};
+
+/**
+ * Heap usage charged to a theme or to application listing. Only
+ * collected when libxdg is configured with --enable-allocation-accounting,
+ * otherwise all fields stay 0, see allocation_accounting_enabled.
+ **/
+struct allocation_stats {
+	uint64_t allocations;   //< calls to operator new.
+	uint64_t deallocations; //< calls to operator delete.
+	uint64_t bytes;         //< total of requested sizes.
+	uint64_t live_bytes;    //< allocated and not yet freed, even by the caller.
+	uint64_t peak_bytes;    //< highest live_bytes.
+};
+
+/**
+ * Work done by libxdg since the creation or the last reset of a theme,
+ * see theme::get_stats, or by application listing, see
+ * get_application_stats. Collecting them only cost a few relaxed atomic
+ * increments and a clock read per timed phase.
+ **/
+struct stats {
+	uint64_t files_parsed;     //< desktop entry and index.theme files.
+	uint64_t bytes_read;       //< size of the parsed files.
+	uint64_t invalid_entries;  //< ignored lines and subdir groups.
+	uint64_t directories_read; //< opendir calls.
+	uint64_t access_calls;
+	uint64_t stat_calls;
+	uint64_t themes_loaded;
+	uint64_t icons_found;      //< resolved icon lookups.
+	uint64_t icons_missing;    //< icon lookups that returned undef.
+	uint64_t cache_hits;       //< icon lookups served by the result cache.
+	uint64_t cache_misses;
+
+	latency_histogram parse;       //< parse of one file.
+	latency_histogram theme_load;  //< read of one index.theme.
+	latency_histogram index_build; //< read of all subdirs of one theme.
+	latency_histogram lookup;      //< icon lookup not served by the cache.
+	latency_histogram scan;        //< one list_all_applications call.
+
+	allocation_stats allocations;  //< live_bytes and peak_bytes survive resets.
+};
+
+/**
+ * Process wide stats of desktop_file, mapped_desktop_file,
+ * application_cache and application_set.
+ **/
+stats get_application_stats();
+void reset_application_stats();
+
+// true if libxdg was built with --enable-allocation-accounting.
+bool allocation_accounting_enabled();
+
+// Process wide allocations, within libxdg or not.
+allocation_stats get_allocation_stats();
+void reset_allocation_stats();
+
+} // namespace xdg
+
+#endif /* SRC_XDG_STATS_HXX_ */
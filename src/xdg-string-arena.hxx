@@ -0,0 +1,79 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SRC_XDG_STRING_ARENA_HXX_
+#define SRC_XDG_STRING_ARENA_HXX_
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+
+#include "xdg-utils.hxx"
+
+namespace xdg {
+
+/**
+ * Strings stored back to back in large blocks instead of one allocation
+ * per string. Stored strings never move, the returned string_view stay
+ * valid as long as the arena, they are not NUL terminated. Strings are
+ * never freed individually.
+ **/
+class string_arena {
+	size_t _block_size;
+	std::vector<std::unique_ptr<char[]>> _blocks;
+	char * _cur;
+	size_t _left;
+	size_t _used;
+
+public:
+	string_arena(size_t block_size = 16384) :
+		_block_size{block_size}, _cur{nullptr}, _left{0}, _used{0} { }
+
+	string_arena(string_arena const &) = delete;
+	string_arena & operator=(string_arena const &) = delete;
+
+	string_view store(string_view const & s)
+	{
+		if (s.size() > _left) {
+			size_t block_size = std::max(s.size(), _block_size);
+			_blocks.emplace_back(new char[block_size]);
+			_cur = _blocks.back().get();
+			_left = block_size;
+		}
+		std::memcpy(_cur, s.data(), s.size());
+		string_view ret{_cur, s.size()};
+		_cur += s.size();
+		_left -= s.size();
+		_used += s.size();
+		return ret;
+	}
+
+	// Bytes of stored strings.
+	size_t used() const { return _used; }
+
+	size_t block_count() const { return _blocks.size(); }
+
+};
+
+} // namespace xdg
+
+#endif /* SRC_XDG_STRING_ARENA_HXX_ */
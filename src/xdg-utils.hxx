@@ -23,31 +23,25 @@ along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
 #define SRC_XDG_UTILS_HXX_
 
 #include <cstdlib>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <functional>
+#include <cstdint>
 
 namespace xdg {
 
 inline std::string getenv_lang()
 {
-	// Extract the default;
-	std::string slocale = "";
-	char const * lc_messages = getenv("LC_MESSAGES");
-	if (lc_messages) {
-		slocale = lc_messages;
-	} else {
-		char const * lc_all = getenv("LC_ALL");
-		if (lc_all) {
-			slocale = lc_messages;
-		} else {
-			char const * lang = getenv("LANG");
-			if (lang)
-				slocale = lang;
-		}
+	// Same precedence as setlocale(LC_MESSAGES, ""), empty values are
+	// ignored.
+	for (auto name: {"LC_ALL", "LC_MESSAGES", "LANG"}) {
+		char const * value = getenv(name);
+		if (value and value[0] != '\0')
+			return value;
 	}
-
-	return slocale;
+	return std::string{};
 }
 
 inline std::vector<std::string> split(std::string const & in, char c)
@@ -64,8 +58,176 @@ inline std::vector<std::string> split(std::string const & in, char c)
 	return ret;
 }
 
+/**
+ * Minimal non-owning view over a char sequence, the library still target
+ * C++11 thus we cannot use std::string_view.
+ **/
+class string_view {
+	char const * _data;
+	size_t _size;
+
+public:
+	static size_t const npos = static_cast<size_t>(-1);
+
+	string_view() : _data{nullptr}, _size{0} { }
+	string_view(char const * data, size_t size) : _data{data}, _size{size} { }
+	string_view(char const * begin, char const * end) : _data{begin}, _size{static_cast<size_t>(end-begin)} { }
+	string_view(char const * s) : _data{s}, _size{std::strlen(s)} { }
+	string_view(std::string const & s) : _data{s.data()}, _size{s.size()} { }
+
+	char const * data() const { return _data; }
+	size_t size() const { return _size; }
+	bool empty() const { return _size == 0; }
+	char const * begin() const { return _data; }
+	char const * end() const { return _data+_size; }
+	char operator[](size_t i) const { return _data[i]; }
+
+	string_view substr(size_t pos, size_t count = npos) const
+	{
+		if (pos > _size)
+			pos = _size;
+		return string_view{_data+pos, std::min(count, _size-pos)};
+	}
+
+	size_t find(char c, size_t pos = 0) const
+	{
+		if (pos >= _size)
+			return npos;
+		auto x = static_cast<char const *>(std::memchr(_data+pos, c, _size-pos));
+		return x?static_cast<size_t>(x-_data):npos;
+	}
+
+	std::string to_string() const
+	{
+		return std::string{_data, _size};
+	}
 
+	friend bool operator==(string_view const & a, string_view const & b)
+	{
+		return a._size == b._size and (a._size == 0 or std::memcmp(a._data, b._data, a._size) == 0);
+	}
+
+	friend bool operator!=(string_view const & a, string_view const & b)
+	{
+		return not (a == b);
+	}
+
+};
+
+/**
+ * Score the locale of localized keys, e.g. Name[sr_RS@latin], against one
+ * locale in the form lang_COUNTRY.ENCODING@MODIFIER, as defined by the
+ * desktop entry spec. The locale is split once, thus a matcher should be
+ * built once and used for all files. Scoring does not allocate and a key
+ * of another language is rejected right after its language.
+ **/
+class locale_matcher {
+	std::string _language;
+	std::string _territory;
+	std::string _modifier;
+
+	// Split s into its parts, the separators are not kept.
+	static void _split(string_view const & s, string_view & language,
+			string_view & territory, string_view & modifier)
+	{
+		auto cur = s.begin();
+		auto end = s.end();
+
+		auto next = cur;
+		while (next != end and *next != '_' and *next != '.' and *next != '@')
+			++next;
+		language = string_view{cur, next};
+		cur = next;
+
+		territory = string_view{};
+		if (cur != end and *cur == '_') {
+			next = ++cur;
+			while (next != end and *next != '.' and *next != '@')
+				++next;
+			territory = string_view{cur, next};
+			cur = next;
+		}
+
+		// The codeset is ignored
+		while (cur != end and *cur != '@')
+			++cur;
+
+		modifier = string_view{};
+		if (cur != end)
+			modifier = string_view{cur+1, end};
+	}
+
+public:
+	explicit locale_matcher(std::string const & locale)
+	{
+		string_view language, territory, modifier;
+		_split(locale, language, territory, modifier);
+		_language = language.to_string();
+		_territory = territory.to_string();
+		_modifier = modifier.to_string();
+	}
+
+	/**
+	 * Score the locale of a localized key: the language must match, the
+	 * territory and the modifier must match if the key has them. Thus for
+	 * lang_COUNTRY@MODIFIER the keys lang_COUNTRY@MODIFIER, lang_COUNTRY,
+	 * lang@MODIFIER and lang score 14, 12, 10 and 8. Return a negative
+	 * value if the key must be discarded.
+	 **/
+	int32_t score(string_view const & locale) const
+	{
+		// The language must be a prefix followed by a separator.
+		size_t n = _language.size();
+		if (n == 0 or locale.size() < n)
+			return -1;
+		for (size_t i = 0; i < n; ++i) {
+			if (locale[i] != _language[i])
+				return -1;
+		}
+		if (locale.size() == n)
+			return 8;
+		if (locale[n] != '_' and locale[n] != '.' and locale[n] != '@')
+			return -1;
+
+		string_view language, territory, modifier;
+		_split(locale, language, territory, modifier);
+
+		int32_t score = 8;
+		if (not territory.empty()) {
+			if (territory != string_view{_territory})
+				return -1;
+			score += 4;
+		}
+
+		if (not modifier.empty()) {
+			if (modifier != string_view{_modifier})
+				return -1;
+			score += 2;
+		}
+
+		return score;
+	}
+
+};
 
 } // namespace xdg
 
+namespace std {
+
+template<>
+struct hash<xdg::string_view> {
+	size_t operator()(xdg::string_view const & s) const
+	{
+		// FNV-1a
+		size_t h = static_cast<size_t>(14695981039346656037ULL);
+		for (auto c: s) {
+			h ^= static_cast<unsigned char>(c);
+			h *= static_cast<size_t>(1099511628211ULL);
+		}
+		return h;
+	}
+};
+
+} // namespace std
+
 #endif /* SRC_XDG_UTILS_HXX_ */
@@ -0,0 +1,198 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "xdg-watcher.hxx"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cerrno>
+
+extern "C" {
+#include <sys/inotify.h>
+#include <unistd.h>
+}
+
+namespace xdg {
+
+using namespace std;
+
+static uint32_t const watch_mask = IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO
+		|IN_CLOSE_WRITE|IN_ONLYDIR;
+
+watcher::watcher()
+{
+	_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+	if (_fd < 0)
+		throw runtime_error("inotify_init1 failed");
+}
+
+watcher::~watcher()
+{
+	close(_fd);
+}
+
+auto watcher::_add_watch(string const & directory) -> bool
+{
+	int wd = inotify_add_watch(_fd, directory.c_str(), watch_mask);
+	if (wd < 0)
+		return false;
+	_watches[wd] = directory;
+	_directories[directory] = wd;
+	return true;
+}
+
+auto watcher::_watch(vector<string> const & directories) -> void
+{
+	for (auto & d: directories) {
+		if (_directories.count(d) or _add_watch(d)) {
+			_missing.erase(d);
+			continue;
+		}
+		// Missing, watch the closest existing parent to see it created.
+		_missing.insert(d);
+		for (auto p = d.rfind('/'); p != string::npos and p > 0; p = d.rfind('/', p-1)) {
+			string parent = d.substr(0, p);
+			if (_directories.count(parent) or _add_watch(parent))
+				break;
+		}
+	}
+}
+
+// Whether path is a missing directory or one of its parents.
+auto watcher::_is_missing_parent(string const & path) const -> bool
+{
+	for (auto x = _missing.lower_bound(path); x != _missing.end()
+			and x->compare(0, path.size(), path) == 0; ++x) {
+		if (x->size() == path.size() or (*x)[path.size()] == '/')
+			return true;
+	}
+	return false;
+}
+
+// Watch again missing directories, return those that now exist.
+auto watcher::_watch_missing() -> vector<string>
+{
+	vector<string> missing{_missing.begin(), _missing.end()};
+	_watch(missing);
+	vector<string> ret;
+	for (auto & d: missing) {
+		if (not _missing.count(d))
+			ret.push_back(d);
+	}
+	return ret;
+}
+
+auto watcher::_sync() -> void
+{
+	for (auto t: _themes)
+		_watch(t->watched_directories());
+	for (auto s: _application_sets)
+		_watch(s->watched_directories());
+}
+
+auto watcher::add(theme & t) -> void
+{
+	_themes.push_back(&t);
+	_watch(t.watched_directories());
+}
+
+auto watcher::add(application_set & s) -> void
+{
+	_application_sets.push_back(&s);
+	_watch(s.watched_directories());
+}
+
+auto watcher::dispatch() -> bool
+{
+	alignas(inotify_event) char buffer[4096];
+	vector<string> paths;
+	bool overflow = false;
+	bool resync = false;
+	bool missing_parent = false;
+
+	for (;;) {
+		auto len = read(_fd, buffer, sizeof(buffer));
+		if (len < 0 and errno == EINTR)
+			continue;
+		if (len <= 0)
+			break; // EAGAIN, nothing left.
+
+		for (char * p = buffer; p < buffer+len;) {
+			auto ev = reinterpret_cast<inotify_event const *>(p);
+			p += sizeof(inotify_event)+ev->len;
+
+			if (ev->mask & IN_Q_OVERFLOW) {
+				overflow = true;
+				continue;
+			}
+
+			auto x = _watches.find(ev->wd);
+			if (x == _watches.end())
+				continue;
+
+			if (ev->mask & IN_IGNORED) {
+				// Removed, watch its closest parent instead.
+				_directories.erase(x->second);
+				_watches.erase(x);
+				resync = true;
+				continue;
+			}
+
+			if (ev->len > 0) {
+				paths.push_back(x->second+"/"+ev->name);
+				missing_parent |= _is_missing_parent(paths.back());
+			}
+		}
+	}
+
+	// A missing directory or one of its parents was created, watch it or
+	// a closer parent. Those created before their watch are reported as
+	// changed paths, thus their content is read.
+	if (missing_parent) {
+		for (auto & d: _watch_missing())
+			paths.push_back(d);
+	}
+
+	bool changed = false;
+	if (overflow) {
+		for (auto t: _themes)
+			t->reload();
+		for (auto s: _application_sets)
+			s->reload();
+		changed = true;
+	} else if (not paths.empty()) {
+		// Only the final state of each path matter.
+		sort(paths.begin(), paths.end());
+		paths.erase(unique(paths.begin(), paths.end()), paths.end());
+		for (auto t: _themes)
+			changed |= t->update(paths);
+		for (auto s: _application_sets)
+			changed |= s->update(paths);
+	}
+
+	// New directories may have shown up, or watched ones removed.
+	if (changed or resync)
+		_sync();
+
+	return changed;
+}
+
+} // namespace xdg
@@ -0,0 +1,81 @@
+/*
+
+Copyright (2021) Benoit Gschwind <gschwind@gnu-log.net>
+
+This file is part of libxdg.
+
+libxdg is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libxdg is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with libxdg.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SRC_XDG_WATCHER_HXX_
+#define SRC_XDG_WATCHER_HXX_
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <set>
+
+#include "xdg-icon-theme.hxx"
+#include "xdg-application-set.hxx"
+
+namespace xdg {
+
+/**
+ * Keep themes and application sets up to date using inotify. The watcher
+ * does not run anything by itself: the caller poll fd() for reading, for
+ * instance within its own event loop, and call dispatch() when it is
+ * ready. Watched objects must outlive the watcher and must not be moved
+ * while watched. Directories that do not exist yet are caught by watching
+ * their closest existing parent.
+ **/
+class watcher {
+	int _fd;
+	std::vector<theme *> _themes;
+	std::vector<application_set *> _application_sets;
+	std::unordered_map<int, std::string> _watches;     //< wd -> directory
+	std::unordered_map<std::string, int> _directories; //< directory -> wd
+	std::set<std::string> _missing; //< wanted but missing, a parent is watched.
+
+	auto _add_watch(std::string const & directory) -> bool;
+	auto _watch(std::vector<std::string> const & directories) -> void;
+	auto _is_missing_parent(std::string const & path) const -> bool;
+	auto _watch_missing() -> std::vector<std::string>;
+	auto _sync() -> void;
+
+public:
+	watcher();
+	~watcher();
+
+	watcher(watcher const &) = delete;
+	watcher & operator=(watcher const &) = delete;
+
+	// Non-blocking inotify file descriptor.
+	int fd() const { return _fd; }
+
+	auto add(theme & t) -> void;
+	auto add(application_set & s) -> void;
+
+	/**
+	 * Read pending events and update the watched objects, return true if
+	 * any of them changed. On inotify queue overflow everything is
+	 * reloaded.
+	 **/
+	auto dispatch() -> bool;
+
+};
+
+} // namespace xdg
+
+#endif /* SRC_XDG_WATCHER_HXX_ */